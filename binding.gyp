@@ -4,6 +4,7 @@
       "target_name": "keymapping",
       "sources": [
         "src/string_conversion.cc",
+        "src/keycode_conversion.cc",
         "src/keymapping.cc"
       ],
       'cflags': [
@@ -31,21 +32,61 @@
         }
       },
       "conditions": [
+        ['OS!="win" and OS!="mac"', {
+          # The keymap `getKeyMapFast` serves until the real one is known
+          "actions": [
+            {
+              "action_name": "generate_default_keymap",
+              "inputs": [
+                "scripts/generate-default-keymap.js",
+                "test/linux/en.txt"
+              ],
+              "outputs": [
+                "<(INTERMEDIATE_DIR)/default_keymap_data.inc"
+              ],
+              "action": ["node", "scripts/generate-default-keymap.js", "<@(_outputs)"]
+            }
+          ],
+          "include_dirs": [
+            "<(INTERMEDIATE_DIR)"
+          ]
+        }],
         ['OS=="linux"', {
           "sources": [
             "deps/chromium/x/keysym_to_unicode.cc",
+            "src/keymap.cc",
+            "src/keybinding_resolver.cc",
+            "src/layout_identification.cc",
+            "src/keymap_cache.cc",
+            "src/keymap_shm.cc",
+            "src/keymap_serialization.cc",
+            "src/compose_table.cc",
+            "src/keyboard_backend_x.cc",
+            "src/keyboard_backend_fake.cc",
+            "src/keyboard_backend_log.cc",
             "src/keyboard_x.cc"
           ],
           "include_dirs": [
             "<!@(${PKG_CONFIG:-pkg-config} x11 xkbfile --cflags | sed s/-I//g)"
           ],
           "libraries": [
-            "<!@(${PKG_CONFIG:-pkg-config} x11 xkbfile --libs)"
+            "<!@(${PKG_CONFIG:-pkg-config} x11 xkbfile --libs)",
+            "-lrt"
           ]
         }],
         ['OS=="freebsd"', {
           "sources": [
             "deps/chromium/x/keysym_to_unicode.cc",
+            "src/keymap.cc",
+            "src/keybinding_resolver.cc",
+            "src/layout_identification.cc",
+            "src/keymap_cache.cc",
+            "src/keymap_shm.cc",
+            "src/keymap_serialization.cc",
+            "src/compose_table.cc",
+            "src/keyboard_backend_x.cc",
+            "src/keyboard_backend_fake.cc",
+            "src/keyboard_backend_log.cc",
             "src/keyboard_x.cc"
           ],
           "include_dirs": [
@@ -77,6 +118,16 @@
         ['OS=="aix"', {
           "sources": [
             "deps/chromium/x/keysym_to_unicode.cc",
+            "src/keymap.cc",
+            "src/keybinding_resolver.cc",
+            "src/layout_identification.cc",
+            "src/keymap_cache.cc",
+            "src/keymap_shm.cc",
+            "src/keymap_serialization.cc",
+            "src/compose_table.cc",
+            "src/keyboard_backend_x.cc",
+            "src/keyboard_backend_fake.cc",
+            "src/keyboard_backend_log.cc",
             "src/keyboard_x.cc"
           ],
           "link_settings": {
@@ -40,6 +40,36 @@ export type IKeyboardMapping = IWindowsKeyboardMapping | ILinuxKeyboardMapping |
 
 export function getKeyMap(): IKeyboardMapping;
 
+/**
+ * Returns a keymap without waiting for the window system. On Linux, until the real keymap is known,
+ * this is a built-in US keymap; the real one is then computed in the background and listeners
+ * registered via `onDidChangeKeyboardLayout` are notified if it differs.
+ */
+export function getKeyMapFast(): IKeyboardMapping;
+
+export interface IKeyboardMappingDiff {
+	/**
+	 * Pass this value to the next `getKeyMapDiff` call.
+	 */
+	epoch: number;
+	/**
+	 * Set when the keymap observed at `sinceEpoch` is no longer retained. `added` then holds
+	 * the whole keymap, which replaces the caller's one instead of being merged into it.
+	 */
+	full: boolean;
+	added: ILinuxKeyboardMapping;
+	removed: string[];
+	changed: ILinuxKeyboardMapping;
+}
+
+/**
+ * Returns the entries that changed since the keymap observed at `sinceEpoch`.
+ * Use `0` to receive the whole keymap, which is also returned, with `full` set, for an epoch
+ * that is no longer retained.
+ * Only implemented on Linux; returns `undefined` elsewhere.
+ */
+export function getKeyMapDiff(sinceEpoch: number): IKeyboardMappingDiff | undefined;
+
 export interface IWindowsKeyboardLayoutInfo {
 	name: string;
 	id: string;
@@ -67,4 +97,294 @@ export function getCurrentKeyboardLayout(): IKeyboardLayoutInfo;
 
 export function onDidChangeKeyboardLayout(callback: () => void): void;
 
+/**
+ * Returns a counter that increases every time a keyboard layout change is observed.
+ * It only advances while a listener is registered via `onDidChangeKeyboardLayout`
+ * (and, on Linux, when `getKeyMap` or `getKeyMapDiff` compute a different keymap).
+ */
+export function getLayoutEpoch(): number;
+
+/**
+ * Returns how many layout change notifications were coalesced because the JS thread
+ * fell behind. The listener never waits for JS: it keeps a bounded queue of changes
+ * and, when the queue is full, only the latest change is still reported.
+ */
+export function getDroppedNotificationCount(): number;
+
 export function isISOKeyboard(): boolean | undefined;
+
+export type KeyboardType = 'ISO' | 'ANSI' | 'JIS' | 'ABNT';
+
+/**
+ * Returns the physical type of the keyboard, which decides e.g. whether there is an
+ * `IntlBackslash` key. Linux and macOS only, undefined if it is unknown. On Linux the
+ * generic pc105 model binds `IntlBackslash` for every layout, so it alone is unknown.
+ */
+export function getKeyboardType(): KeyboardType | undefined;
+
+export interface ILinuxModifierMasks {
+	alt: number;
+	meta: number;
+	numLock: number;
+	modeSwitch: number;
+	level3: number;
+	level5: number;
+}
+
+export interface IKeyboardSnapshot {
+	epoch: number;
+	layout: IKeyboardLayoutInfo | null;
+	keyMap: IKeyboardMapping;
+	isISOKeyboard: boolean | undefined;
+	/**
+	 * The X modifier masks used to compute the keymap. Only present on Linux.
+	 */
+	modifiers?: ILinuxModifierMasks;
+}
+
+/**
+ * Returns the layout, the keymap and the keyboard type read together, so that they always belong to each other.
+ */
+export function getKeyboardSnapshot(): IKeyboardSnapshot;
+
+export interface IConnectionOptions {
+	/**
+	 * How long a query waits for the X display to be opened, in milliseconds. Defaults to 2000.
+	 */
+	timeout?: number;
+	/**
+	 * The longest time a failed connection is remembered before it is retried, in milliseconds. Defaults to 60000.
+	 */
+	maxBackoff?: number;
+}
+
+/**
+ * Configures how the X display is opened. Only has an effect on Linux.
+ */
+export function setConnectionOptions(options: IConnectionOptions): void;
+
+/**
+ * Enables a cache of computed keymaps in `directory`, keyed by the rules, model, layout, variant,
+ * options and group of the layout. At startup the cached keymap is returned right away and validated
+ * in the background; listeners registered via `onDidChangeKeyboardLayout` are notified if it was stale.
+ * Pass `null` to disable the cache. Only has an effect on Linux.
+ */
+export function setKeyMapCacheDirectory(directory: string | null): void;
+
+/**
+ * Publishes every keymap this process computes into the shared memory segment `name`, so that other
+ * processes can read it via `subscribeSharedKeyMap` without talking to the X server. Combine with
+ * `onDidChangeKeyboardLayout` to keep the published keymap up to date. Only one process can publish
+ * into a segment. Only implemented on Linux; returns `undefined` elsewhere.
+ */
+export function publishSharedKeyMap(name: string): boolean | undefined;
+
+/**
+ * Serves `getKeyMap` from the keymap another process publishes into the shared memory segment `name`,
+ * once one was published. While no process publishes into it, e.g. after the publisher exited, the
+ * keymap is read from the X server again. Only implemented on Linux; returns `undefined` elsewhere.
+ */
+export function subscribeSharedKeyMap(name: string): boolean | undefined;
+
+/**
+ * Serialize the current keyboard mapping to a compact buffer, e.g. to send it to another process.
+ * When `delta` is true, only the differences from a built-in US layout are encoded.
+ * Returns null if not supported on the current platform.
+ */
+export function serializeKeyMap(delta?: boolean): Uint8Array | null;
+
+/**
+ * Decode a buffer produced by `serializeKeyMap` in a process using the same build of this module.
+ * Returns null if the buffer is invalid or if not supported on the current platform.
+ */
+export function deserializeKeyMap(data: Uint8Array): IKeyboardMapping | null;
+
+/**
+ * Returns a 64-bit hash of the current keyboard mapping's content, as 16 hex digits.
+ * Unlike the layout name, it changes whenever the produced characters change, so it
+ * can be used to key data derived from the keyboard mapping across sessions.
+ * Returns null if not supported on the current platform.
+ */
+export function getKeyMapFingerprint(): string | null;
+
+export interface ITranslatedKeys {
+  /**
+   * The codes `codeIndices` refer to.
+   */
+  readonly codes: string[];
+  /**
+   * For every key, the index of its code in `codes`, or -1 if the keycode is unknown.
+   */
+  readonly codeIndices: Int32Array;
+  /**
+   * For every key, the character it produces, or 0 if it produces none.
+   */
+  readonly characters: Uint32Array;
+}
+
+/**
+ * Translate a batch of key presses, each given by its xkb keycode and a modifier
+ * mask (alt = 1, ctrl = 2, meta = 4, shift = 8, num lock = 16, level3 = 32, level5 = 64).
+ * `states` must have the same length as `keycodes`.
+ * Returns null if not supported on the current platform.
+ */
+export function translateKeys(keycodes: Uint32Array, states: Uint32Array): ITranslatedKeys | null;
+
+/**
+ * Returns the table of UI Events `code` values the `'code'` keycode kind indexes.
+ * Index 0 is null and stands for an unknown key.
+ */
+export function getDomCodes(): (string | null)[];
+
+export type KeycodeKind = 'usb' | 'evdev' | 'xkb' | 'code';
+
+/**
+ * Convert a batch of keycodes between USB HID usages, evdev scancodes, xkb keycodes
+ * and indices into `getDomCodes()`. Keycodes without a mapping are converted to 0.
+ */
+export function convertKeycodes(values: Uint32Array, from: KeycodeKind, to: KeycodeKind): Uint32Array | null;
+
+export interface IKeyClasses {
+  readonly codes: string[];
+  /**
+   * For every code, 5 bits per level, in the order value, withShift, withAltGr,
+   * withShiftAltGr, withLevel5, withLevel3Level5. Level `i` is at bit `5 * i`:
+   * printable = 1, dead = 2, modifier = 4, function = 8, keypad = 16.
+   */
+  readonly classes: Uint32Array;
+}
+
+/**
+ * Classify the keysym each key produces on every level, e.g. to find dead keys.
+ * Returns null if not supported on the current platform or if no display is available.
+ */
+export function getKeyClasses(): IKeyClasses | null;
+
+/**
+ * Look up what a compose sequence produces, e.g. `['dead_acute', 'e']` or `['Multi_key', 'a', 'e']`,
+ * using the X Compose files in effect ($XCOMPOSEFILE, ~/.XCompose or the one of the locale).
+ * The environment is read once; edits to the files are picked up within two seconds.
+ * Returns null if the keysyms are not a complete compose sequence or if not supported on the current platform.
+ */
+export function getComposeResult(keysyms: string[]): string | null;
+
+/**
+ * Find the compose sequences that produce `text`, as arrays of keysym names.
+ * Returns an empty array if not supported on the current platform.
+ */
+export function findComposeSequences(text: string): string[][];
+
+/**
+ * Register a listener that receives the modifier states observed since the previous
+ * call, at most once per event loop tick. Each state is a bitmask of shift = 1,
+ * control = 2, alt = 4, meta = 8, altGraph = 16, level5 = 32, capsLock = 64 and
+ * numLock = 128, with the effective group in bits 8 and up.
+ * Only supported on Linux; only one listener can be registered per thread.
+ */
+export function onDidChangeModifierState(callback: (states: Uint32Array) => void): void;
+
+/**
+ * Returns the current modifier state, encoded like the states passed to `onDidChangeModifierState`.
+ * While a listener is registered this does not contact the X server.
+ * Returns null if not supported on the current platform or if no display is available.
+ */
+export function getModifierState(): number | null;
+
+export interface IKeyboardGeometry {
+	/**
+	 * The size of the keyboard, in tenths of a millimeter.
+	 */
+	width: number;
+	height: number;
+	codes: string[];
+	/**
+	 * The outline of the key of each code, as x, y, width and height in tenths of a millimeter.
+	 */
+	rects: Int32Array;
+}
+
+/**
+ * Returns the physical layout of the keys, as configured in XKB. It is fetched once
+ * per keyboard, so calling this again is cheap. Linux only.
+ */
+export function getKeyboardGeometry(): IKeyboardGeometry | null | undefined;
+
+/**
+ * Locks the keyboard to the group at `index` of the current layout, without
+ * spawning setxkbmap. The keymap of the group is built beforehand, or taken
+ * from the cache if the group was active before, so `onDidChangeKeyboardLayout`
+ * is followed by a cheap `getKeyMap`. XKB has at most 4 groups, so `index` is
+ * between 0 and 3. Returns whether the group was switched. Linux only.
+ */
+export function setKeyboardGroup(index: number): boolean | undefined;
+
+/**
+ * Loads a layout from its XKB rules, model, layout, variant and options, like
+ * setxkbmap does, looking up rules files in $XKB_CONFIG_ROOT if it is set. The
+ * names that are not given keep their current values.
+ * The keymap of a layout that was active before is taken from the cache.
+ * Returns whether the layout was loaded. Linux only.
+ */
+export function setKeyboardLayout(layout: { rules?: string; model?: string; layout?: string; variant?: string; options?: string; }): boolean | undefined;
+
+export interface IResolvedKeybindings {
+  /**
+   * The indices of the keybindings whose resolution changed since the last call.
+   */
+  readonly indices: Uint32Array;
+  /**
+   * For every changed keybinding, e.g. `'Ctrl+K Ctrl+Shift+7'`.
+   */
+  readonly labels: string[];
+  /**
+   * For every changed keybinding, the code index and the modifiers each of its
+   * two chords is pressed with, as in `setKeybindings`. A chord's code index is
+   * 0 if it is unused or untypeable.
+   */
+  readonly chords: Uint32Array;
+  /**
+   * For every changed keybinding: untypeable = 1.
+   */
+  readonly flags: Uint32Array;
+  /**
+   * For every changed keybinding, another keybinding that is pressed with the
+   * same chords, or -1.
+   */
+  readonly conflicts: Int32Array;
+}
+
+/**
+ * Set the keybindings `resolveKeybindings` resolves, packed as four words per
+ * keybinding: a key and a modifier mask (alt = 1, ctrl = 2, meta = 4, shift = 8)
+ * for each of its two chords. A key is either a character, which is typed on
+ * whichever key produces it, or an index into `getDomCodes()` with the bit
+ * 0x80000000 set. The key of an unused chord is 0.
+ */
+export function setKeybindings(bindings: Uint32Array): void;
+
+/**
+ * Resolve the keybindings against the current keymap: the keys and modifiers
+ * their chords are pressed with, their labels and which of them collide.
+ * Only the keybindings whose resolution changed since the last call are
+ * reported, so after a layout switch that does not affect them nothing is.
+ * The first call after `setKeybindings` reports every keybinding.
+ * Returns null if not supported on the current platform or if no display is available.
+ */
+export function resolveKeybindings(): IResolvedKeybindings | null;
+
+export interface ILayoutMatch {
+  layout: string;
+  variant: string;
+  /**
+   * How much the keymap differs from the layout, 0 if it types the same characters.
+   */
+  distance: number;
+}
+
+/**
+ * Find the standard xkeyboard-config layout that types most like the current keymap,
+ * e.g. when custom XKB files or xmodmap make `getCurrentKeyboardLayout` report a
+ * misleading name. Compares the characters of the writing system keys on every level.
+ * Returns null if no display is available. Linux only.
+ */
+export function identifyLayout(): ILayoutMatch | null | undefined;
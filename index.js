@@ -6,6 +6,7 @@
 function NativeBinding() {
   this._tried = false;
   this._keymapping = null;
+  this._loggedErrors = {};
 }
 NativeBinding.prototype._init = function() {
   if (this._tried) {
@@ -19,12 +20,30 @@ NativeBinding.prototype._init = function() {
     this._keymapping = require('./build/Debug/keymapping');
   }
 };
+NativeBinding.prototype._logError = function(err) {
+  // e.g. a missing native module would otherwise be reported on every call
+  var message = String(err);
+  if (this._loggedErrors[message]) {
+    return;
+  }
+  this._loggedErrors[message] = true;
+  console.error(err);
+};
 NativeBinding.prototype.getKeyMap = function() {
   try {
     this._init();
     return this._keymapping.getKeyMap();
   } catch(err) {
-    console.error(err);
+    this._logError(err);
+    return [];
+  }
+};
+NativeBinding.prototype.getKeyMapFast = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyMapFast();
+  } catch(err) {
+    this._logError(err);
     return [];
   }
 };
@@ -33,7 +52,7 @@ NativeBinding.prototype.getCurrentKeyboardLayout = function() {
     this._init();
     return this._keymapping.getCurrentKeyboardLayout();
   } catch(err) {
-    console.error(err);
+    this._logError(err);
     return null;
   }
 };
@@ -42,7 +61,7 @@ NativeBinding.prototype.onDidChangeKeyboardLayout = function(callback) {
     this._init();
     this._keymapping.onDidChangeKeyboardLayout(callback);
   } catch(err) {
-    console.error(err);
+    this._logError(err);
   }
 }
 NativeBinding.prototype.isISOKeyboard = function(callback) {
@@ -54,6 +73,262 @@ NativeBinding.prototype.isISOKeyboard = function(callback) {
   }
 }
 
+NativeBinding.prototype.getKeyMapDiff = function(sinceEpoch) {
+  try {
+    this._init();
+    return this._keymapping.getKeyMapDiff(sinceEpoch);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getLayoutEpoch = function() {
+  try {
+    this._init();
+    return this._keymapping.getLayoutEpoch();
+  } catch(err) {
+    this._logError(err);
+    return 0;
+  }
+};
+
+NativeBinding.prototype.getDroppedNotificationCount = function() {
+  try {
+    this._init();
+    return this._keymapping.getDroppedNotificationCount();
+  } catch(err) {
+    this._logError(err);
+    return 0;
+  }
+};
+
+NativeBinding.prototype.getKeyboardSnapshot = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyboardSnapshot();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.setConnectionOptions = function(options) {
+  try {
+    this._init();
+    this._keymapping.setConnectionOptions(options);
+  } catch(err) {
+    this._logError(err);
+  }
+};
+
+NativeBinding.prototype.setKeyMapCacheDirectory = function(directory) {
+  try {
+    this._init();
+    this._keymapping.setKeyMapCacheDirectory(directory);
+  } catch(err) {
+    this._logError(err);
+  }
+};
+
+NativeBinding.prototype.publishSharedKeyMap = function(name) {
+  try {
+    this._init();
+    return this._keymapping.publishSharedKeyMap(name);
+  } catch(err) {
+    this._logError(err);
+    return false;
+  }
+};
+
+NativeBinding.prototype.subscribeSharedKeyMap = function(name) {
+  try {
+    this._init();
+    return this._keymapping.subscribeSharedKeyMap(name);
+  } catch(err) {
+    this._logError(err);
+    return false;
+  }
+};
+
+NativeBinding.prototype.serializeKeyMap = function(delta) {
+  try {
+    this._init();
+    return this._keymapping.serializeKeyMap(delta);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.deserializeKeyMap = function(data) {
+  try {
+    this._init();
+    return this._keymapping.deserializeKeyMap(data);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getKeyMapFingerprint = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyMapFingerprint();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.translateKeys = function(keycodes, states) {
+  try {
+    this._init();
+    return this._keymapping.translateKeys(keycodes, states);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getDomCodes = function() {
+  try {
+    this._init();
+    return this._keymapping.getDomCodes();
+  } catch(err) {
+    this._logError(err);
+    return [];
+  }
+};
+
+NativeBinding.prototype.convertKeycodes = function(values, from, to) {
+  try {
+    this._init();
+    return this._keymapping.convertKeycodes(values, from, to);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getKeyClasses = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyClasses();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getComposeResult = function(keysyms) {
+  try {
+    this._init();
+    return this._keymapping.getComposeResult(keysyms);
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.findComposeSequences = function(text) {
+  try {
+    this._init();
+    return this._keymapping.findComposeSequences(text);
+  } catch(err) {
+    this._logError(err);
+    return [];
+  }
+};
+
+NativeBinding.prototype.onDidChangeModifierState = function(callback) {
+  try {
+    this._init();
+    this._keymapping.onDidChangeModifierState(callback);
+  } catch(err) {
+    this._logError(err);
+  }
+};
+
+NativeBinding.prototype.getModifierState = function() {
+  try {
+    this._init();
+    return this._keymapping.getModifierState();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.getKeyboardType = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyboardType();
+  } catch(err) {
+    this._logError(err);
+    return undefined;
+  }
+};
+
+NativeBinding.prototype.getKeyboardGeometry = function() {
+  try {
+    this._init();
+    return this._keymapping.getKeyboardGeometry();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.setKeyboardGroup = function(group) {
+  try {
+    this._init();
+    return this._keymapping.setKeyboardGroup(group);
+  } catch(err) {
+    this._logError(err);
+    return false;
+  }
+};
+
+NativeBinding.prototype.setKeyboardLayout = function(layout) {
+  try {
+    this._init();
+    return this._keymapping.setKeyboardLayout(layout);
+  } catch(err) {
+    this._logError(err);
+    return false;
+  }
+};
+
+NativeBinding.prototype.setKeybindings = function(bindings) {
+  try {
+    this._init();
+    this._keymapping.setKeybindings(bindings);
+  } catch(err) {
+    this._logError(err);
+  }
+};
+
+NativeBinding.prototype.resolveKeybindings = function() {
+  try {
+    this._init();
+    return this._keymapping.resolveKeybindings();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
+NativeBinding.prototype.identifyLayout = function() {
+  try {
+    this._init();
+    return this._keymapping.identifyLayout();
+  } catch(err) {
+    this._logError(err);
+    return null;
+  }
+};
+
 var binding = new NativeBinding();
 
 exports.getCurrentKeyboardLayout = function() {
@@ -62,9 +337,90 @@ exports.getCurrentKeyboardLayout = function() {
 exports.getKeyMap = function() {
   return binding.getKeyMap();
 };
+exports.getKeyMapFast = function() {
+  return binding.getKeyMapFast();
+};
 exports.onDidChangeKeyboardLayout = function(callback) {
   return binding.onDidChangeKeyboardLayout(callback);
 };
 exports.isISOKeyboard = function(callback) {
   return binding.isISOKeyboard(callback);
 };
+exports.getKeyMapDiff = function(sinceEpoch) {
+  return binding.getKeyMapDiff(sinceEpoch);
+};
+exports.getLayoutEpoch = function() {
+  return binding.getLayoutEpoch();
+};
+exports.getDroppedNotificationCount = function() {
+  return binding.getDroppedNotificationCount();
+};
+exports.getKeyboardSnapshot = function() {
+  return binding.getKeyboardSnapshot();
+};
+exports.setConnectionOptions = function(options) {
+  return binding.setConnectionOptions(options);
+};
+exports.setKeyMapCacheDirectory = function(directory) {
+  return binding.setKeyMapCacheDirectory(directory);
+};
+exports.publishSharedKeyMap = function(name) {
+  return binding.publishSharedKeyMap(name);
+};
+exports.subscribeSharedKeyMap = function(name) {
+  return binding.subscribeSharedKeyMap(name);
+};
+exports.serializeKeyMap = function(delta) {
+  return binding.serializeKeyMap(delta);
+};
+exports.deserializeKeyMap = function(data) {
+  return binding.deserializeKeyMap(data);
+};
+exports.getKeyMapFingerprint = function() {
+  return binding.getKeyMapFingerprint();
+};
+exports.translateKeys = function(keycodes, states) {
+  return binding.translateKeys(keycodes, states);
+};
+exports.getDomCodes = function() {
+  return binding.getDomCodes();
+};
+exports.convertKeycodes = function(values, from, to) {
+  return binding.convertKeycodes(values, from, to);
+};
+exports.getKeyClasses = function() {
+  return binding.getKeyClasses();
+};
+exports.getComposeResult = function(keysyms) {
+  return binding.getComposeResult(keysyms);
+};
+exports.findComposeSequences = function(text) {
+  return binding.findComposeSequences(text);
+};
+exports.onDidChangeModifierState = function(callback) {
+  return binding.onDidChangeModifierState(callback);
+};
+exports.getModifierState = function() {
+  return binding.getModifierState();
+};
+exports.getKeyboardType = function() {
+  return binding.getKeyboardType();
+};
+exports.getKeyboardGeometry = function() {
+  return binding.getKeyboardGeometry();
+};
+exports.setKeyboardGroup = function(group) {
+  return binding.setKeyboardGroup(group);
+};
+exports.setKeyboardLayout = function(layout) {
+  return binding.setKeyboardLayout(layout);
+};
+exports.setKeybindings = function(bindings) {
+  return binding.setKeybindings(bindings);
+};
+exports.resolveKeybindings = function() {
+  return binding.resolveKeybindings();
+};
+exports.identifyLayout = function() {
+  return binding.identifyLayout();
+};
@@ -0,0 +1,62 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+// Generates default_keymap_data.inc from the US keymap recorded in test/linux/en.txt.
+// Run by binding.gyp with the path of the file to write.
+
+var fs = require('fs');
+var path = require('path');
+
+var LEVELS = ['value', 'withShift', 'withAltGr', 'withShiftAltGr', 'withLevel5', 'withLevel3Level5'];
+
+var source = path.join(__dirname, '..', 'test', 'linux', 'en.txt');
+var target = process.argv[2];
+if (!target) {
+  throw new Error('Usage: node generate-default-keymap.js <output file>');
+}
+
+function readRecordedKeyMap(file) {
+  var contents = fs.readFileSync(file, 'utf8');
+  var start = contents.indexOf('getKeyMap:');
+  if (start === -1) {
+    throw new Error('No keymap found in ' + file);
+  }
+  // The recording is the output of `util.inspect`, which is a valid object literal
+  return new Function('return (' + contents.substr(start + 'getKeyMap:'.length) + ');')();
+}
+
+function toCString(str) {
+  var result = '"';
+  var bytes = Buffer.from(str, 'utf8');
+  for (var i = 0; i < bytes.length; i++) {
+    var b = bytes[i];
+    if (b === 0x22 || b === 0x5c) {
+      result += '\\' + String.fromCharCode(b);
+    } else if (b >= 0x20 && b < 0x7f) {
+      result += String.fromCharCode(b);
+    } else {
+      // Octal escapes never consume the characters that follow them
+      result += '\\' + ('00' + b.toString(8)).substr(-3);
+    }
+  }
+  return result + '"';
+}
+
+var keyMap = readRecordedKeyMap(source);
+var lines = [
+  '// This file is generated by scripts/generate-default-keymap.js from test/linux/en.txt. Do not edit.',
+  '//',
+  '// This file has no header guard because it is explicitly intended to be',
+  '// included with a definition of the macro DEFAULT_KEY_MAPPING.',
+  '',
+  '// DEFAULT_KEY_MAPPING(code, ' + LEVELS.join(', ') + ')'
+];
+Object.keys(keyMap).forEach(function(code) {
+  var entry = keyMap[code];
+  var values = LEVELS.map(function(level) { return toCString(entry[level] || ''); });
+  lines.push('DEFAULT_KEY_MAPPING(' + [toCString(code)].concat(values).join(', ') + ')');
+});
+
+fs.writeFileSync(target, lines.join('\n') + '\n');
@@ -0,0 +1,116 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+// Generates src/known_layouts_data.inc, the signatures `identifyLayout` matches keymaps
+// against, by loading every layout and variant listed in the xkeyboard-config rules
+// into the X server and reading back its keymap. The layout is restored afterwards.
+// Run `npm run generate-known-layouts [-- path/to/rules.lst]` in an X session after building.
+
+var fs = require('fs');
+var path = require('path');
+var keymap = require('..');
+
+var LEVELS = ['value', 'withShift', 'withAltGr', 'withShiftAltGr', 'withLevel5', 'withLevel3Level5'];
+
+// The keys of the writing system. Must match `kSignatureCodes` in src/layout_identification.cc
+var CODES = [
+  'Backquote', 'Digit1', 'Digit2', 'Digit3', 'Digit4', 'Digit5', 'Digit6', 'Digit7', 'Digit8', 'Digit9', 'Digit0', 'Minus', 'Equal',
+  'KeyQ', 'KeyW', 'KeyE', 'KeyR', 'KeyT', 'KeyY', 'KeyU', 'KeyI', 'KeyO', 'KeyP', 'BracketLeft', 'BracketRight', 'Backslash',
+  'KeyA', 'KeyS', 'KeyD', 'KeyF', 'KeyG', 'KeyH', 'KeyJ', 'KeyK', 'KeyL', 'Semicolon', 'Quote',
+  'IntlBackslash', 'KeyZ', 'KeyX', 'KeyC', 'KeyV', 'KeyB', 'KeyN', 'KeyM', 'Comma', 'Period', 'Slash',
+  'IntlRo', 'IntlYen'
+];
+
+// Every key and level contributes the top bits of the Fibonacci hash of its character
+var BITS_PER_CELL = 4;
+var WORD_COUNT = Math.ceil(CODES.length * LEVELS.length * BITS_PER_CELL / 64);
+
+var source = process.argv[2] || '/usr/share/X11/xkb/rules/evdev.lst';
+var target = path.join(__dirname, '..', 'src', 'known_layouts_data.inc');
+
+function readLayouts(file) {
+  var layouts = [];
+  var section = null;
+  fs.readFileSync(file, 'utf8').split('\n').forEach(function(line) {
+    if (line.charAt(0) === '!') {
+      section = line.substr(1).trim();
+      return;
+    }
+    var match = /^\s+(\S+)\s+(\S+?):?\s/.exec(line + ' ');
+    if (!match) {
+      return;
+    }
+    if (section === 'layout') {
+      layouts.push({ layout: match[1], variant: '' });
+    } else if (section === 'variant') {
+      // e.g. "  dvorak          us: English (Dvorak)"
+      layouts.push({ layout: match[2], variant: match[1] });
+    }
+  });
+  return layouts;
+}
+
+// Like `DigestCharacter` in src/layout_identification.cc
+function digestCharacter(value) {
+  var character = value.codePointAt(0) || 0;
+  return BigInt(Math.imul(character, 0x9e3779b1) >>> (32 - BITS_PER_CELL));
+}
+
+function computeSignature(keyMap) {
+  var words = [];
+  for (var i = 0; i < WORD_COUNT; i++) {
+    words.push(0n);
+  }
+  var cell = 0;
+  CODES.forEach(function(code) {
+    LEVELS.forEach(function(level) {
+      var value = (keyMap[code] && keyMap[code][level]) || '';
+      var digest = digestCharacter(value);
+      var bit = cell * BITS_PER_CELL;
+      words[Math.floor(bit / 64)] |= digest << BigInt(bit % 64);
+      cell++;
+    });
+  });
+  return words;
+}
+
+function toHex(word) {
+  return '0x' + ('0000000000000000' + word.toString(16)).substr(-16) + 'ULL';
+}
+
+var original = keymap.getCurrentKeyboardLayout();
+if (!original || original.rules === undefined) {
+  throw new Error('Needs an X session');
+}
+
+var entries = [];
+var seen = new Set();
+readLayouts(source).forEach(function(entry) {
+  if (!keymap.setKeyboardLayout({ layout: entry.layout, variant: entry.variant, options: '' })) {
+    console.warn('Skipped ' + entry.layout + (entry.variant ? '(' + entry.variant + ')' : ''));
+    return;
+  }
+  var words = computeSignature(keymap.getKeyMap());
+  // Variants that type the same as an earlier entry cannot be told apart
+  var key = words.join(',');
+  if (seen.has(key)) {
+    return;
+  }
+  seen.add(key);
+  entries.push('KNOWN_LAYOUT(' + [JSON.stringify(entry.layout), JSON.stringify(entry.variant)].concat(words.map(toHex)).join(', ') + ')');
+});
+keymap.setKeyboardLayout(original);
+
+var lines = [
+  '// This file is generated by scripts/generate-known-layouts.js from ' + path.basename(source) + '. Do not edit.',
+  '//',
+  '// This file has no header guard because it is explicitly intended to be',
+  '// included with a definition of the macro KNOWN_LAYOUT.',
+  '',
+  '// KNOWN_LAYOUT(layout, variant, ' + WORD_COUNT + ' signature words)'
+].concat(entries);
+
+fs.writeFileSync(target, lines.join('\n') + '\n');
+console.log('Wrote ' + entries.length + ' layouts to ' + path.relative(process.cwd(), target));
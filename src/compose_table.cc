@@ -0,0 +1,617 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "compose_table.h"
+#include "keymap.h"
+#include "keymap_cache.h"
+#include "string_conversion.h"
+
+#include <X11/Xlib.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include "../deps/chromium/x/keysym_to_unicode.h"
+
+namespace vscode_keyboard {
+
+namespace {
+
+const char kMagic[4] = {'N', 'K', 'C', 'T'};
+const uint32_t kVersion = 2;
+
+// Marks nodes that do not complete a sequence
+const uint32_t kNoValue = UINT32_MAX;
+
+// Bounds the nesting of include directives, which may form cycles
+const int kMaxIncludeDepth = 8;
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+  // See `HashSourceFiles`
+  uint64_t source_files_hash;
+  uint32_t node_count;
+  uint32_t string_pool_size;
+  // The NUL-terminated paths of the files, which follow the string pool
+  uint32_t source_files_size;
+  uint32_t reserved;
+} ComposeTableHeader;
+
+typedef struct {
+  uint32_t keysym;
+  // Children are stored at [first_child, first_child + child_count), sorted by keysym
+  uint32_t first_child;
+  uint32_t child_count;
+  // Offset into the string pool, or kNoValue
+  uint32_t value;
+} ComposeTableNode;
+
+std::string GetEnv(const char *name) {
+  const char *value = getenv(name);
+  return (value ? value : "");
+}
+
+bool FileExists(const std::string &path) {
+  struct stat st;
+  return (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+}
+
+std::string GetLocaleDirectory() {
+  std::string directory = GetEnv("XLOCALEDIR");
+  return (directory.empty() ? "/usr/share/X11/locale" : directory);
+}
+
+std::string GetLocaleName() {
+  for (const char *name : {"LC_ALL", "LC_CTYPE", "LANG"}) {
+    std::string locale = GetEnv(name);
+    if (!locale.empty()) {
+      return locale;
+    }
+  }
+  return "C";
+}
+
+// Reads files such as compose.dir and locale.alias, whose lines consist of two
+// fields separated by whitespace, the first one optionally followed by a colon.
+// Returns the first field of the line whose second field is `value`, or the
+// other way around if `match_first` is set.
+bool FindInNameTable(const std::string &path, const std::string &value, bool match_first, std::string *result) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+
+  bool found = false;
+  char line[1024];
+  while (!found && fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    char first[512];
+    char second[512];
+    if (sscanf(line, "%511s %511s", first, second) != 2) {
+      continue;
+    }
+    size_t first_length = strlen(first);
+    if (first_length > 0 && first[first_length - 1] == ':') {
+      first[first_length - 1] = '\0';
+    }
+    if (value == (match_first ? first : second)) {
+      *result = (match_first ? second : first);
+      found = true;
+    }
+  }
+
+  fclose(file);
+  return found;
+}
+
+std::string GetLocaleComposeFile() {
+  std::string directory = GetLocaleDirectory();
+  std::string locale = GetLocaleName();
+  std::string file;
+  if (!FindInNameTable(directory + "/compose.dir", locale, false, &file)) {
+    std::string alias;
+    if (!FindInNameTable(directory + "/locale.alias", locale, true, &alias)
+        || !FindInNameTable(directory + "/compose.dir", alias, false, &file)) {
+      return std::string();
+    }
+  }
+  return directory + "/" + file;
+}
+
+// Follows libX11 in preferring the user's Compose file over the locale's.
+std::string GetUserComposeFile() {
+  std::string path = GetEnv("XCOMPOSEFILE");
+  if (!path.empty()) {
+    return path;
+  }
+  std::string home = GetEnv("HOME");
+  if (!home.empty() && FileExists(home + "/.XCompose")) {
+    return home + "/.XCompose";
+  }
+  return std::string();
+}
+
+uint64_t HashFile(const std::string &path, uint64_t hash) {
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  stat(path.c_str(), &st);
+  int64_t attributes[3] = {
+    static_cast<int64_t>(st.st_mtim.tv_sec),
+    static_cast<int64_t>(st.st_mtim.tv_nsec),
+    static_cast<int64_t>(st.st_size)
+  };
+  hash = HashString(path, hash);
+  return HashBytes(attributes, sizeof(attributes), hash);
+}
+
+// Identifies the modification times of every file a table was compiled from.
+uint64_t HashSourceFiles(const std::vector<std::string> &paths) {
+  uint64_t hash = kHashSeed;
+  for (const std::string &path : paths) {
+    hash = HashFile(path, hash);
+  }
+  return hash;
+}
+
+// Identifies the Compose files a table is loaded from and their modification times.
+uint64_t GetSourceFingerprint() {
+  uint64_t hash = kHashSeed;
+  hash = HashString(GetLocaleName(), hash);
+  std::string user_file = GetUserComposeFile();
+  if (!user_file.empty()) {
+    hash = HashFile(user_file, hash);
+  }
+  std::string locale_file = GetLocaleComposeFile();
+  if (!locale_file.empty()) {
+    hash = HashFile(locale_file, hash);
+  }
+  return hash;
+}
+
+class ComposeTrieBuilder {
+ public:
+  ComposeTrieBuilder() : nodes_(1) {}
+
+  // Files that cannot be opened are recorded too, because they may be created later
+  void AddSourceFile(const std::string &path) {
+    if (std::find(source_files_.begin(), source_files_.end(), path) == source_files_.end()) {
+      source_files_.push_back(path);
+    }
+  }
+
+  std::vector<std::string>* source_files() { return &source_files_; }
+
+  // Later definitions of a sequence replace earlier ones, as in libX11
+  void Add(const std::vector<uint32_t> &keysyms, const std::string &value) {
+    size_t index = 0;
+    for (uint32_t keysym : keysyms) {
+      auto it = nodes_[index].children.find(keysym);
+      if (it == nodes_[index].children.end()) {
+        nodes_.push_back(BuildNode());
+        it = nodes_[index].children.emplace(keysym, nodes_.size() - 1).first;
+      }
+      index = it->second;
+    }
+    nodes_[index].value = value;
+    nodes_[index].has_value = true;
+  }
+
+  bool empty() const {
+    return nodes_.size() == 1;
+  }
+
+  // Lays the nodes out breadth first, so that siblings are adjacent.
+  void Pack(uint64_t fingerprint, std::string *dst) const {
+    std::string pool(1, '\0');
+    std::map<std::string, uint32_t> pool_offsets;
+    pool_offsets[""] = 0;
+
+    std::vector<ComposeTableNode> packed(nodes_.size());
+    packed[0].keysym = 0;
+    uint32_t next_index = 1;
+    std::deque<std::pair<size_t, uint32_t>> queue;
+    queue.push_back(std::make_pair(0, 0));
+    while (!queue.empty()) {
+      const BuildNode &node = nodes_[queue.front().first];
+      ComposeTableNode &packed_node = packed[queue.front().second];
+      queue.pop_front();
+
+      packed_node.value = kNoValue;
+      if (node.has_value) {
+        auto it = pool_offsets.find(node.value);
+        if (it == pool_offsets.end()) {
+          it = pool_offsets.emplace(node.value, static_cast<uint32_t>(pool.size())).first;
+          pool.append(node.value.c_str(), node.value.size() + 1);
+        }
+        packed_node.value = it->second;
+      }
+
+      packed_node.first_child = next_index;
+      packed_node.child_count = static_cast<uint32_t>(node.children.size());
+      for (const auto &child : node.children) {
+        packed[next_index].keysym = child.first;
+        queue.push_back(std::make_pair(child.second, next_index));
+        ++next_index;
+      }
+    }
+
+    std::string source_files;
+    for (const std::string &path : source_files_) {
+      source_files.append(path.c_str(), path.size() + 1);
+    }
+
+    ComposeTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.fingerprint = fingerprint;
+    header.source_files_hash = HashSourceFiles(source_files_);
+    header.node_count = static_cast<uint32_t>(packed.size());
+    header.string_pool_size = static_cast<uint32_t>(pool.size());
+    header.source_files_size = static_cast<uint32_t>(source_files.size());
+
+    dst->clear();
+    dst->reserve(sizeof(header) + packed.size() * sizeof(ComposeTableNode) + pool.size() + source_files.size());
+    dst->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    dst->append(reinterpret_cast<const char*>(packed.data()), packed.size() * sizeof(ComposeTableNode));
+    dst->append(pool);
+    dst->append(source_files);
+  }
+
+ private:
+  struct BuildNode {
+    BuildNode() : has_value(false) {}
+    std::map<uint32_t, size_t> children;
+    std::string value;
+    bool has_value;
+  };
+
+  std::vector<BuildNode> nodes_;
+  std::vector<std::string> source_files_;
+};
+
+void SkipWhitespace(const char **p) {
+  while (**p == ' ' || **p == '\t') {
+    ++*p;
+  }
+}
+
+// Parses a double-quoted string with the escapes described in Compose(5).
+bool ParseQuotedString(const char **p, std::string *result) {
+  if (**p != '"') {
+    return false;
+  }
+  ++*p;
+  result->clear();
+  while (**p && **p != '"') {
+    if (**p != '\\') {
+      *result += *(*p)++;
+      continue;
+    }
+    ++*p;
+    if (**p >= '0' && **p <= '7') {
+      int value = 0;
+      for (int i = 0; i < 3 && **p >= '0' && **p <= '7'; ++i) {
+        value = value * 8 + (*(*p)++ - '0');
+      }
+      *result += static_cast<char>(value);
+    } else if ((**p == 'x' || **p == 'X') && isxdigit(static_cast<unsigned char>((*p)[1]))) {
+      ++*p;
+      int value = 0;
+      for (int i = 0; i < 2 && isxdigit(static_cast<unsigned char>(**p)); ++i, ++*p) {
+        value = value * 16 + (isdigit(static_cast<unsigned char>(**p)) ? **p - '0' : (tolower(**p) - 'a' + 10));
+      }
+      *result += static_cast<char>(value);
+    } else if (**p == 'n') {
+      *result += '\n';
+      ++*p;
+    } else if (**p == 't') {
+      *result += '\t';
+      ++*p;
+    } else if (**p) {
+      *result += *(*p)++;
+    }
+  }
+  if (**p != '"') {
+    return false;
+  }
+  ++*p;
+  return true;
+}
+
+std::string ParseName(const char **p) {
+  const char *start = *p;
+  while (isalnum(static_cast<unsigned char>(**p)) || **p == '_') {
+    ++*p;
+  }
+  return std::string(start, *p - start);
+}
+
+std::string ExpandIncludePath(const std::string &path) {
+  std::string result;
+  for (size_t i = 0; i < path.size(); ++i) {
+    if (path[i] != '%' || i + 1 == path.size()) {
+      result += path[i];
+      continue;
+    }
+    switch (path[++i]) {
+      case 'H': result += GetEnv("HOME"); break;
+      case 'L': result += GetLocaleComposeFile(); break;
+      case 'S': result += GetLocaleDirectory(); break;
+      default: result += path[i]; break;
+    }
+  }
+  return result;
+}
+
+bool ParseComposeFile(const std::string &path, int depth, ComposeTrieBuilder *builder);
+
+// Lines that cannot be parsed, or that depend on modifiers, are skipped like libX11 does.
+void ParseComposeLine(const char *line, int depth, ComposeTrieBuilder *builder) {
+  const char *p = line;
+  SkipWhitespace(&p);
+
+  if (strncmp(p, "include", 7) == 0) {
+    p += 7;
+    SkipWhitespace(&p);
+    std::string include_path;
+    if (ParseQuotedString(&p, &include_path)) {
+      ParseComposeFile(ExpandIncludePath(include_path), depth + 1, builder);
+    }
+    return;
+  }
+
+  std::vector<uint32_t> keysyms;
+  while (*p == '<') {
+    const char *end = strchr(p, '>');
+    if (!end) {
+      return;
+    }
+    std::string name(p + 1, end - p - 1);
+    KeySym keysym = XStringToKeysym(name.c_str());
+    if (keysym == NoSymbol) {
+      return;
+    }
+    keysyms.push_back(static_cast<uint32_t>(keysym));
+    p = end + 1;
+    SkipWhitespace(&p);
+  }
+  if (keysyms.empty() || *p != ':') {
+    return;
+  }
+  ++p;
+  SkipWhitespace(&p);
+
+  std::string value;
+  bool has_value = ParseQuotedString(&p, &value);
+  SkipWhitespace(&p);
+  if (!has_value) {
+    // Only a keysym is given, which stands for the character it produces
+    std::string name = ParseName(&p);
+    KeySym keysym = (name.empty() ? NoSymbol : XStringToKeysym(name.c_str()));
+    wchar_t character = ui::GetUnicodeCharacterFromXKeySym(keysym);
+    if (!character) {
+      return;
+    }
+    value = UTF16toUTF8(&character, 1);
+  }
+
+  builder->Add(keysyms, value);
+}
+
+bool ParseComposeFile(const std::string &path, int depth, ComposeTrieBuilder *builder) {
+  if (depth > kMaxIncludeDepth) {
+    return false;
+  }
+
+  builder->AddSourceFile(path);
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+
+  char *line = NULL;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, file) != -1) {
+    ParseComposeLine(line, depth, builder);
+  }
+
+  free(line);
+  fclose(file);
+  return true;
+}
+
+// Fills `source_files` with the paths the table was compiled from.
+bool IsValidTable(const char *data, size_t size, uint64_t fingerprint, std::vector<std::string> *source_files) {
+  if (size < sizeof(ComposeTableHeader)) {
+    return false;
+  }
+
+  const ComposeTableHeader *header = reinterpret_cast<const ComposeTableHeader*>(data);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion || header->fingerprint != fingerprint) {
+    return false;
+  }
+
+  size_t nodes_size = static_cast<size_t>(header->node_count) * sizeof(ComposeTableNode);
+  if (header->node_count == 0 || header->string_pool_size == 0 || header->source_files_size == 0
+      || size != sizeof(ComposeTableHeader) + nodes_size + header->string_pool_size + header->source_files_size) {
+    return false;
+  }
+
+  // All strings are terminated if the pool is
+  const ComposeTableNode *nodes = reinterpret_cast<const ComposeTableNode*>(data + sizeof(ComposeTableHeader));
+  const char *pool = data + sizeof(ComposeTableHeader) + nodes_size;
+  const char *paths = pool + header->string_pool_size;
+  if (pool[header->string_pool_size - 1] != '\0' || paths[header->source_files_size - 1] != '\0') {
+    return false;
+  }
+
+  // An included file may have changed even though the Compose files did not
+  source_files->clear();
+  for (const char *path = paths; path < paths + header->source_files_size; path += strlen(path) + 1) {
+    source_files->push_back(path);
+  }
+  if (HashSourceFiles(*source_files) != header->source_files_hash) {
+    return false;
+  }
+
+  // Children always come after their parent, which rules out cycles
+  for (uint32_t i = 0; i < header->node_count; ++i) {
+    const ComposeTableNode &node = nodes[i];
+    if (node.value != kNoValue && node.value >= header->string_pool_size) {
+      return false;
+    }
+    if (node.child_count > 0 && (node.first_child <= i || node.first_child > header->node_count
+                                 || node.child_count > header->node_count - node.first_child)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+ComposeTable::ComposeTable(std::vector<std::string> *source_files, const char *data, size_t size, void *mapping, std::string *owned_data)
+  : data_(data), size_(size), mapping_(mapping) {
+  source_files_.swap(*source_files);
+  source_files_hash_ = HashSourceFiles(source_files_);
+  if (owned_data) {
+    owned_data_.swap(*owned_data);
+    data_ = owned_data_.data();
+    size_ = owned_data_.size();
+  }
+}
+
+ComposeTable::~ComposeTable() {
+  if (mapping_) {
+    munmap(mapping_, size_);
+  }
+}
+
+bool ComposeTable::IsOutdated() const {
+  return HashSourceFiles(source_files_) != source_files_hash_;
+}
+
+ComposeTable* ComposeTable::Load(const std::string &cache_directory) {
+  uint64_t fingerprint = GetSourceFingerprint();
+
+  char name[32];
+  snprintf(name, sizeof(name), "compose-%016llx.bin", static_cast<unsigned long long>(fingerprint));
+
+  if (!cache_directory.empty()) {
+    std::string path = cache_directory + "/" + name;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+      struct stat st;
+      void *mapping = MAP_FAILED;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      close(fd);
+      if (mapping != MAP_FAILED) {
+        std::vector<std::string> source_files;
+        if (IsValidTable(static_cast<const char*>(mapping), st.st_size, fingerprint, &source_files)) {
+          return new ComposeTable(&source_files, static_cast<const char*>(mapping), st.st_size, mapping, NULL);
+        }
+        munmap(mapping, st.st_size);
+      }
+    }
+  }
+
+  std::string path = GetUserComposeFile();
+  if (path.empty()) {
+    path = GetLocaleComposeFile();
+  }
+  ComposeTrieBuilder builder;
+  if (path.empty() || !ParseComposeFile(path, 0, &builder) || builder.empty()) {
+    return NULL;
+  }
+
+  // The files that decide which Compose file is used, so that e.g. creating
+  // ~/.XCompose is noticed without resolving the paths again
+  std::string locale_directory = GetLocaleDirectory();
+  builder.AddSourceFile(locale_directory + "/compose.dir");
+  builder.AddSourceFile(locale_directory + "/locale.alias");
+  std::string home = GetEnv("HOME");
+  if (GetEnv("XCOMPOSEFILE").empty() && !home.empty()) {
+    builder.AddSourceFile(home + "/.XCompose");
+  }
+
+  std::string packed;
+  builder.Pack(fingerprint, &packed);
+  if (!cache_directory.empty()) {
+    WriteCacheFile(cache_directory, name, packed);
+  }
+  return new ComposeTable(builder.source_files(), NULL, 0, NULL, &packed);
+}
+
+bool ComposeTable::Lookup(const std::vector<uint32_t> &keysyms, std::string *result) const {
+  const ComposeTableHeader *header = reinterpret_cast<const ComposeTableHeader*>(data_);
+  const ComposeTableNode *nodes = reinterpret_cast<const ComposeTableNode*>(data_ + sizeof(ComposeTableHeader));
+  const char *pool = reinterpret_cast<const char*>(nodes + header->node_count);
+
+  const ComposeTableNode *node = &nodes[0];
+  for (uint32_t keysym : keysyms) {
+    const ComposeTableNode *first = nodes + node->first_child;
+    const ComposeTableNode *last = first + node->child_count;
+    const ComposeTableNode *child = std::lower_bound(first, last, keysym, [](const ComposeTableNode &n, uint32_t k) {
+      return n.keysym < k;
+    });
+    if (child == last || child->keysym != keysym) {
+      return false;
+    }
+    node = child;
+  }
+
+  if (node == &nodes[0] || node->value == kNoValue) {
+    return false;
+  }
+  *result = pool + node->value;
+  return true;
+}
+
+void ComposeTable::FindSequences(const std::string &text, std::vector<std::vector<uint32_t>> *sequences) const {
+  const ComposeTableHeader *header = reinterpret_cast<const ComposeTableHeader*>(data_);
+  const ComposeTableNode *nodes = reinterpret_cast<const ComposeTableNode*>(data_ + sizeof(ComposeTableHeader));
+  const char *pool = reinterpret_cast<const char*>(nodes + header->node_count);
+
+  // Depth first, keeping the keysyms leading to the current node in `path`
+  std::vector<uint32_t> path;
+  std::vector<std::pair<uint32_t, size_t>> stack;
+  stack.push_back(std::make_pair(0, 0));
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    size_t depth = stack.back().second;
+    stack.pop_back();
+
+    const ComposeTableNode &node = nodes[index];
+    path.resize(depth);
+    if (index != 0) {
+      path.push_back(node.keysym);
+    }
+    if (node.value != kNoValue && index != 0 && text == pool + node.value) {
+      sequences->push_back(path);
+    }
+    for (uint32_t i = node.child_count; i > 0; --i) {
+      stack.push_back(std::make_pair(node.first_child + i - 1, path.size()));
+    }
+  }
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,61 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef COMPOSE_TABLE_H_
+#define COMPOSE_TABLE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace vscode_keyboard {
+
+// The compose sequences of the libX11 Compose files in effect for this process:
+// $XCOMPOSEFILE, else ~/.XCompose, else the Compose file of the current locale.
+//
+// The sequences are compiled into a trie that is queried in place: a header, then
+// fixed size nodes whose children are stored next to each other sorted by keysym,
+// then a pool of NUL-terminated UTF-8 results, then the paths of the files the table
+// was compiled from. Compiled tables are cached on disk, keyed by the paths and
+// modification times of the Compose files, and checked against the ones they include.
+//
+// The environment is read by `Load` only, which also records the files that decide
+// which Compose file is used, e.g. compose.dir, so `IsOutdated` merely stats files.
+class ComposeTable {
+ public:
+  // Returns NULL if there is no Compose file. `cache_directory` may be empty.
+  static ComposeTable* Load(const std::string &cache_directory);
+
+  ~ComposeTable();
+
+  // Returns true if one of the files the table was compiled from, included ones
+  // too, or one that decides which Compose file is used has changed.
+  bool IsOutdated() const;
+
+  // Returns false if `keysyms` is not a complete compose sequence.
+  bool Lookup(const std::vector<uint32_t> &keysyms, std::string *result) const;
+
+  // Appends every sequence that produces `text`.
+  void FindSequences(const std::string &text, std::vector<std::vector<uint32_t>> *sequences) const;
+
+ private:
+  ComposeTable(std::vector<std::string> *source_files, const char *data, size_t size, void *mapping, std::string *owned_data);
+
+  // Every file the table was compiled from, and the hash of their modification times
+  std::vector<std::string> source_files_;
+  uint64_t source_files_hash_;
+  const char *data_;
+  size_t size_;
+  // Either the read-only mapping of the cache file or a freshly compiled table
+  void *mapping_;
+  std::string owned_data_;
+
+  ComposeTable(const ComposeTable&) = delete;
+  ComposeTable& operator=(const ComposeTable&) = delete;
+};
+
+}  // namespace vscode_keyboard
+
+#endif  // COMPOSE_TABLE_H_
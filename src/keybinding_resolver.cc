@@ -0,0 +1,201 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keybinding_resolver.h"
+#include "keymapping.h"
+
+#include <string.h>
+
+#include <unordered_map>
+#include <utility>
+
+namespace vscode_keyboard {
+
+namespace {
+
+typedef struct {
+  int key;
+  int level;
+} KeyLevel;
+
+const uint32_t kChordModifiersMask = kAltKeyModifierMask | kControlKeyModifierMask | kMetaKeyModifierMask
+                                     | kShiftKeyModifierMask | kLevel3KeyModifierMask | kLevel5KeyModifierMask;
+
+// A resolved chord fits into 24 bits: DOM code indices are below 2^16, the modifiers below 2^7
+const int kChordSignatureBits = 24;
+
+bool IsPrintable(uint32_t character) {
+  return character > 0x20 && character != 0x7f && !(character >= 0x80 && character < 0xa0);
+}
+
+bool IsKeypadKey(const KeyMapping &mapping) {
+  return strncmp(mapping.code, "Numpad", 6) == 0;
+}
+
+void AppendModifierLabels(uint32_t modifiers, std::string *label) {
+  static const struct {
+    uint32_t mask;
+    const char *label;
+  } kModifierLabels[] = {
+    {kControlKeyModifierMask, "Ctrl+"},
+    {kShiftKeyModifierMask, "Shift+"},
+    {kAltKeyModifierMask, "Alt+"},
+    {kMetaKeyModifierMask, "Super+"},
+    {kLevel3KeyModifierMask, "AltGr+"},
+    {kLevel5KeyModifierMask, "Level5+"}
+  };
+  for (const auto &modifier : kModifierLabels) {
+    if (modifiers & modifier.mask) {
+      label->append(modifier.label);
+    }
+  }
+}
+
+// Letters are shown in upper case, like on the keycaps
+void AppendCharacterLabel(uint32_t character, std::string *label) {
+  if (character >= 'a' && character <= 'z') {
+    character -= 'a' - 'A';
+  }
+  AppendCharacter(character, label);
+}
+
+// Keys that type no printable character are shown by their code, e.g. "Enter", "Space" or "F1".
+void AppendKeyLabel(const KeyMapping &mapping, std::string *label) {
+  uint32_t character = DecodeCharacter(mapping.values[0]);
+  if (IsPrintable(character)) {
+    AppendCharacterLabel(character, label);
+  } else {
+    label->append(mapping.code);
+  }
+}
+
+} // namespace
+
+KeybindingResolver::KeybindingResolver() : has_resolutions_(false), key_map_fingerprint_(0) {}
+
+void KeybindingResolver::SetBindings(const uint32_t *words, size_t word_count) {
+  bindings_.assign(words, words + word_count - word_count % kWordsPerBinding);
+  resolutions_.clear();
+  has_resolutions_ = false;
+}
+
+void KeybindingResolver::Resolve(const KeyMap &key_map, const std::vector<uint32_t> &code_indices, std::vector<uint32_t> *changed) {
+  changed->clear();
+  uint64_t fingerprint = KeyMapFingerprint(key_map);
+  if (has_resolutions_ && fingerprint == key_map_fingerprint_) {
+    return;
+  }
+
+  // The keymap entry of every DOM code
+  std::vector<int> keys_by_code;
+  for (size_t i = 0; i < key_map.size() && i < code_indices.size(); ++i) {
+    if (code_indices[i] >= keys_by_code.size()) {
+      keys_by_code.resize(code_indices[i] + 1, -1);
+    }
+    keys_by_code[code_indices[i]] = i;
+  }
+
+  // The key that types each character, on the lowest level that has it. The
+  // keypad only types the characters that no other key has, e.g. '/' on a
+  // Swiss German keyboard is Shift+7 rather than NumpadDivide.
+  std::unordered_map<uint32_t, KeyLevel> keys_by_character;
+  for (bool keypad : {false, true}) {
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      for (size_t i = 0; i < key_map.size() && i < code_indices.size(); ++i) {
+        uint32_t character = DecodeCharacter(key_map[i].values[level]);
+        if (character && IsKeypadKey(key_map[i]) == keypad) {
+          keys_by_character.emplace(character, KeyLevel{static_cast<int>(i), static_cast<int>(level)});
+        }
+      }
+    }
+  }
+
+  size_t binding_count = bindings_.size() / kWordsPerBinding;
+  std::vector<Resolution> resolutions(binding_count);
+  // Identifies the chords of every typeable binding, 0 for the others
+  std::vector<uint64_t> signatures(binding_count, 0);
+  // The first two bindings that are pressed with each sequence of chords
+  std::unordered_map<uint64_t, std::pair<int32_t, int32_t>> bindings_by_signature;
+
+  for (size_t binding = 0; binding < binding_count; ++binding) {
+    const uint32_t *words = &bindings_[binding * kWordsPerBinding];
+    Resolution &resolution = resolutions[binding];
+    memset(resolution.chords, 0, sizeof(resolution.chords));
+    resolution.flags = 0;
+    resolution.conflict = -1;
+
+    uint64_t signature = 0;
+    for (size_t chord = 0; chord < kChordCount && words[2 * chord]; ++chord) {
+      uint32_t key = words[2 * chord];
+      uint32_t modifiers = words[2 * chord + 1] & kChordModifiersMask;
+      if (chord > 0) {
+        resolution.label.push_back(' ');
+      }
+
+      int key_index = -1;
+      if (key & kCodeKeyFlag) {
+        uint32_t code_index = key & ~kCodeKeyFlag;
+        key_index = (code_index < keys_by_code.size() ? keys_by_code[code_index] : -1);
+      } else {
+        // Keybindings name letters in lower case
+        uint32_t character = (key >= 'A' && key <= 'Z' ? key + ('a' - 'A') : key);
+        auto it = keys_by_character.find(character);
+        if (it != keys_by_character.end()) {
+          key_index = it->second.key;
+          modifiers |= kLevelModifiers[it->second.level];
+        }
+      }
+
+      AppendModifierLabels(modifiers, &resolution.label);
+      if (key_index < 0) {
+        // Unknown codes are left for the caller to name
+        resolution.flags |= kUntypeable;
+        if (!(key & kCodeKeyFlag)) {
+          AppendCharacterLabel(key, &resolution.label);
+        }
+        continue;
+      }
+
+      AppendKeyLabel(key_map[key_index], &resolution.label);
+      resolution.chords[2 * chord] = code_indices[key_index];
+      resolution.chords[2 * chord + 1] = modifiers;
+      signature |= static_cast<uint64_t>(code_indices[key_index] | (modifiers << 16)) << (chord * kChordSignatureBits);
+    }
+
+    if (signature && !(resolution.flags & kUntypeable)) {
+      signatures[binding] = signature;
+      auto inserted = bindings_by_signature.emplace(signature, std::make_pair(static_cast<int32_t>(binding), -1));
+      if (!inserted.second && inserted.first->second.second < 0) {
+        inserted.first->second.second = binding;
+      }
+    }
+  }
+
+  for (size_t binding = 0; binding < binding_count; ++binding) {
+    if (!signatures[binding]) {
+      continue;
+    }
+    const std::pair<int32_t, int32_t> &colliding = bindings_by_signature[signatures[binding]];
+    resolutions[binding].conflict = (colliding.first == static_cast<int32_t>(binding) ? colliding.second : colliding.first);
+  }
+
+  for (size_t binding = 0; binding < binding_count; ++binding) {
+    const Resolution &resolution = resolutions[binding];
+    if (has_resolutions_) {
+      const Resolution &previous = resolutions_[binding];
+      if (memcmp(previous.chords, resolution.chords, sizeof(resolution.chords)) == 0 && previous.label == resolution.label
+          && previous.flags == resolution.flags && previous.conflict == resolution.conflict) {
+        continue;
+      }
+    }
+    changed->push_back(binding);
+  }
+
+  resolutions_.swap(resolutions);
+  has_resolutions_ = true;
+  key_map_fingerprint_ = fingerprint;
+}
+
+}  // namespace vscode_keyboard
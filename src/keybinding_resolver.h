@@ -0,0 +1,69 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYBINDING_RESOLVER_H_
+#define KEYBINDING_RESOLVER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "keymap.h"
+
+namespace vscode_keyboard {
+
+// Resolves a table of keybindings against keymaps: which key and modifiers
+// each chord is pressed with, its label, and which bindings collide.
+//
+// The table is packed as `kWordsPerBinding` words per binding, a key and a
+// `KeyModifierMask` for each of its chords. A key is either a character, or
+// an index into the DOM codes of dom_code_data.inc with `kCodeKeyFlag` set.
+// The key of an unused chord is 0.
+class KeybindingResolver {
+ public:
+  static const size_t kChordCount = 2;
+  static const size_t kWordsPerBinding = 2 * kChordCount;
+  static const uint32_t kCodeKeyFlag = 0x80000000;
+
+  enum Flag {
+    // A chord's character is not on any key, or its code is not on the keyboard
+    kUntypeable = 1 << 0
+  };
+
+  typedef struct {
+    // The DOM code index and `KeyModifierMask` each chord is pressed with, or 0
+    uint32_t chords[kWordsPerBinding];
+    // E.g. "Ctrl+K Ctrl+Shift+7"
+    std::string label;
+    uint32_t flags;
+    // Another binding pressed with the same chords, or -1
+    int32_t conflict;
+  } Resolution;
+
+  KeybindingResolver();
+
+  // Replaces the table, so that the next `Resolve` reports every binding.
+  void SetBindings(const uint32_t *words, size_t word_count);
+
+  // Resolves every binding against `key_map`, whose entries are at the DOM
+  // code indices `code_indices`. Fills `changed` with the bindings whose
+  // resolution differs from the previous one.
+  void Resolve(const KeyMap &key_map, const std::vector<uint32_t> &code_indices, std::vector<uint32_t> *changed);
+
+  const Resolution& resolution(size_t binding) const { return resolutions_[binding]; }
+
+ private:
+  std::vector<uint32_t> bindings_;
+  std::vector<Resolution> resolutions_;
+  bool has_resolutions_;
+  uint64_t key_map_fingerprint_;
+
+  KeybindingResolver(const KeybindingResolver&) = delete;
+  KeybindingResolver& operator=(const KeybindingResolver&) = delete;
+};
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYBINDING_RESOLVER_H_
@@ -0,0 +1,136 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYBOARD_BACKEND_H_
+#define KEYBOARD_BACKEND_H_
+
+#include <X11/Xlib.h>
+
+#include <string>
+#include <vector>
+
+namespace vscode_keyboard {
+
+// The XKB state of the core keyboard, see `XkbGetState`.
+typedef struct {
+  int group;
+  unsigned int mods;
+  unsigned int locked_mods;
+} KeyboardState;
+
+// The names the keyboard was configured with, see `XkbRF_GetNamesProp`.
+typedef struct {
+  std::string rules;
+  std::string model;
+  std::string layout;
+  std::string variant;
+  std::string options;
+} KeyboardNames;
+
+// The outline of a key in tenths of a millimeter, see `XkbGetGeometry`.
+typedef struct {
+  unsigned int keycode;
+  int x;
+  int y;
+  int width;
+  int height;
+} KeyGeometry;
+
+typedef struct {
+  int width;
+  int height;
+  std::vector<KeyGeometry> keys;
+} KeyboardGeometry;
+
+enum KeyMapChange {
+  kKeyMapUnchanged,
+  kKeyMapKeySymsChanged,
+  kKeyMapFullyChanged
+};
+
+typedef struct {
+  enum {
+    kStateChanged,
+    kMappingChanged
+  } type;
+  // kStateChanged
+  KeyboardState state;
+  // kMappingChanged. The keysyms of the keycodes in [first_keycode,
+  // first_keycode + keycode_count) changed if `change` is kKeyMapKeySymsChanged.
+  KeyMapChange change;
+  bool modifiers_changed;
+  int first_keycode;
+  int keycode_count;
+  // A different keyboard, which may also have a different geometry, was attached
+  bool keyboard_changed;
+} KeyboardEvent;
+
+// Everything the Linux implementation needs from the keyboard. A backend is
+// used by one thread at a time.
+class KeyboardBackend {
+ public:
+  static const int kModifierCount = 8;
+
+  virtual ~KeyboardBackend() {}
+
+  // Fills `modifiers` with the keysyms (at group 0, level 0) of the keys
+  // bound to each core modifier, from Shift to Mod5.
+  virtual void GetModifierMapping(std::vector<KeySym> modifiers[kModifierCount]) = 0;
+
+  // Returns the keysym a key press produces with the core protocol `state`,
+  // which also holds the group in bits 13 and 14.
+  virtual KeySym LookupKeySym(unsigned int keycode, unsigned int state) = 0;
+
+  virtual bool GetState(KeyboardState *state) = 0;
+
+  // Returns false if the names are unknown.
+  virtual bool GetNames(KeyboardNames *names) = 0;
+
+  // Returns false if the keyboard has no geometry.
+  virtual bool GetGeometry(KeyboardGeometry *geometry) = 0;
+
+  // Locks the keyboard to `group`, see `XkbLockGroup`. Returns false if the
+  // backend cannot switch groups or the keymap has no such group.
+  virtual bool LockGroup(int group) = 0;
+
+  // Compiles the keymap `names` resolve to and loads it into the server, like
+  // setxkbmap does. Returns false if the backend cannot load keymaps or the
+  // names do not resolve.
+  virtual bool SetLayout(const KeyboardNames &names) = 0;
+
+  // Selects the events `WaitForEvent` reports. Mapping changes are always
+  // reported, state changes only if `state_changes` is set.
+  virtual bool SelectEvents(bool state_changes) = 0;
+
+  // Returns false if no event arrived within `timeout_ms`. The backend has
+  // already applied a reported mapping change to its own lookups.
+  virtual bool WaitForEvent(int timeout_ms, KeyboardEvent *event) = 0;
+};
+
+// Takes ownership of `display`.
+KeyboardBackend* CreateXlibKeyboardBackend(Display *display);
+
+// Serves the layout recorded in a fixture like test/linux/en.txt, which holds
+// the output of test/test.js. Returns NULL if the file cannot be read.
+//
+// The fixture's levels are bound to Shift, Mod5 (ISO_Level3_Shift) and Mod3
+// (ISO_Level5_Shift). Only the group can be changed, but every group maps the
+// same keysyms. No events are reported and there is no geometry.
+KeyboardBackend* LoadFakeKeyboardBackend(const std::string &path);
+
+// Records the replies and events of `backend` into the session log at `path`,
+// which every recording backend of this process shares, told apart by `stream`.
+// Takes ownership of `backend`, which is returned as is if the log cannot be opened.
+KeyboardBackend* CreateRecordingKeyboardBackend(KeyboardBackend *backend, const std::string &path, int stream);
+
+// Replays `stream` of a session log. Replies are served as they were recorded
+// before each event, and events are reported as long after opening the backend
+// as they were recorded, or right away unless `original_speed` is set.
+// Returns NULL if the log cannot be read or has no such stream.
+KeyboardBackend* LoadReplayKeyboardBackend(const std::string &path, int stream, bool original_speed);
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYBOARD_BACKEND_H_
@@ -0,0 +1,349 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keyboard_backend.h"
+#include "keymap.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <X11/keysym.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace vscode_keyboard {
+
+namespace {
+
+typedef struct {
+  uint32_t xkb;
+  const char *code;
+} FixtureCodeEntry;
+
+#define DOM_CODE(usb, evdev, xkb, win, mac, code, id) {xkb, code}
+#define DOM_CODE_DECLARATION const FixtureCodeEntry kFixtureCodes[] =
+#include "../deps/chromium/dom_code_data.inc"
+#undef DOM_CODE
+#undef DOM_CODE_DECLARATION
+
+// X keycodes are in [8, 255]
+const unsigned int kKeycodeCount = 256;
+
+unsigned int FindKeycode(const std::string &code) {
+  for (const FixtureCodeEntry &entry : kFixtureCodes) {
+    if (entry.code && entry.xkb > 0 && code == entry.code) {
+      return entry.xkb;
+    }
+  }
+  return 0;
+}
+
+// The inverse of `GetUnicodeCharacterFromXKeySym` for the characters of a fixture.
+KeySym KeySymFromCharacter(uint32_t character) {
+  switch (character) {
+    case 0:
+      return NoSymbol;
+    case 0x08:
+      return XK_BackSpace;
+    case 0x09:
+      return XK_Tab;
+    case 0x0d:
+      return XK_Return;
+    case 0x1b:
+      return XK_Escape;
+    case 0x7f:
+      return XK_Delete;
+  }
+  if ((character >= 0x20 && character <= 0x7e) || (character >= 0xa0 && character <= 0xff)) {
+    return character;
+  }
+  return 0x01000000 | character;
+}
+
+// Parses the `util.inspect` output of test/test.js, which is close enough to
+// JavaScript object literals: unquoted keys, single or double quoted strings
+// and nested objects.
+class FixtureParser {
+ public:
+  FixtureParser(const std::string &text) : text_(text), pos_(0) {}
+
+  // Moves behind the first line starting with `label`.
+  bool Seek(const char *label) {
+    size_t pos = (text_.compare(0, strlen(label), label) == 0 ? 0 : text_.find(std::string("\n") + label));
+    if (pos == std::string::npos) {
+      return false;
+    }
+    pos_ = text_.find(label, pos) + strlen(label);
+    return true;
+  }
+
+  bool ParseNull() {
+    SkipWhitespace();
+    if (text_.compare(pos_, 4, "null") != 0) {
+      return false;
+    }
+    pos_ += 4;
+    return true;
+  }
+
+  // Calls `on_entry(key)` for every entry of an object, which has to consume the value.
+  template <typename Callback>
+  bool ParseObject(Callback on_entry) {
+    if (!Consume('{')) {
+      return false;
+    }
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      if (!ParseKey(&key) || !Consume(':') || !on_entry(key)) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  bool ParseInteger(int *dst) {
+    SkipWhitespace();
+    const char *start = text_.c_str() + pos_;
+    char *end;
+    *dst = strtol(start, &end, 10);
+    pos_ += end - start;
+    return end > start;
+  }
+
+  bool ParseString(std::string *dst) {
+    SkipWhitespace();
+    if (pos_ >= text_.size() || (text_[pos_] != '\'' && text_[pos_] != '"')) {
+      return false;
+    }
+    char quote = text_[pos_++];
+    dst->clear();
+    while (pos_ < text_.size() && text_[pos_] != quote) {
+      char c = text_[pos_++];
+      if (c != '\\') {
+        dst->push_back(c);
+        continue;
+      }
+      if (pos_ >= text_.size()) {
+        return false;
+      }
+      c = text_[pos_++];
+      switch (c) {
+        case 'b': dst->push_back('\b'); break;
+        case 'f': dst->push_back('\f'); break;
+        case 'n': dst->push_back('\n'); break;
+        case 'r': dst->push_back('\r'); break;
+        case 't': dst->push_back('\t'); break;
+        case 'v': dst->push_back('\v'); break;
+        case '0': dst->push_back('\0'); break;
+        case 'x':
+        case 'u': {
+          size_t digits = (c == 'x' ? 2 : 4);
+          if (pos_ + digits > text_.size()) {
+            return false;
+          }
+          AppendCharacter(strtoul(text_.substr(pos_, digits).c_str(), NULL, 16), dst);
+          pos_ += digits;
+          break;
+        }
+        default: dst->push_back(c); break;
+      }
+    }
+    return Consume(quote);
+  }
+
+ private:
+  void SkipWhitespace() {
+    while (pos_ < text_.size() && isspace(static_cast<unsigned char>(text_[pos_]))) {
+      ++pos_;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipWhitespace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool ParseKey(std::string *dst) {
+    SkipWhitespace();
+    if (pos_ < text_.size() && (text_[pos_] == '\'' || text_[pos_] == '"')) {
+      return ParseString(dst);
+    }
+    size_t start = pos_;
+    while (pos_ < text_.size() && (isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_' || text_[pos_] == '$')) {
+      ++pos_;
+    }
+    dst->assign(text_, start, pos_ - start);
+    return pos_ > start;
+  }
+
+  const std::string &text_;
+  size_t pos_;
+};
+
+class FakeKeyboardBackend : public KeyboardBackend {
+ public:
+  FakeKeyboardBackend() : has_names_(false), group_(0) {
+    memset(keysyms_, 0, sizeof(keysyms_));
+  }
+
+  bool Load(const std::string &text) {
+    FixtureParser parser(text);
+
+    if (parser.Seek("getCurrentKeyboardLayout:") && !parser.ParseNull()) {
+      has_names_ = parser.ParseObject([this, &parser](const std::string &key) {
+        // Fixtures recorded since the group is reported also hold the group
+        if (key == "group") {
+          return parser.ParseInteger(&group_);
+        }
+        std::string value;
+        if (!parser.ParseString(&value)) {
+          return false;
+        }
+        if (key == "rules") {
+          names_.rules = value;
+        } else if (key == "model") {
+          names_.model = value;
+        } else if (key == "layout") {
+          names_.layout = value;
+        } else if (key == "variant") {
+          names_.variant = value;
+        } else if (key == "options") {
+          names_.options = value;
+        }
+        return true;
+      });
+      if (!has_names_) {
+        return false;
+      }
+    }
+
+    if (!parser.Seek("getKeyMap:")) {
+      return false;
+    }
+    return parser.ParseObject([this, &parser](const std::string &code) {
+      unsigned int keycode = FindKeycode(code);
+      return parser.ParseObject([this, &parser, keycode](const std::string &level_name) {
+        std::string value;
+        if (!parser.ParseString(&value)) {
+          return false;
+        }
+        for (size_t level = 0; level < kLevelCount; ++level) {
+          if (keycode && keycode < kKeycodeCount && level_name == kLevelNames[level]) {
+            keysyms_[keycode][level] = KeySymFromCharacter(DecodeCharacter(value));
+          }
+        }
+        return true;
+      });
+    });
+  }
+
+  void GetModifierMapping(std::vector<KeySym> modifiers[kModifierCount]) override {
+    static const KeySym kModifierKeySyms[kModifierCount] = {
+      XK_Shift_L,           // Shift
+      XK_Caps_Lock,         // Lock
+      XK_Control_L,         // Control
+      XK_Alt_L,             // Mod1
+      XK_Num_Lock,          // Mod2
+      XK_ISO_Level5_Shift,  // Mod3
+      XK_Super_L,           // Mod4
+      XK_ISO_Level3_Shift   // Mod5
+    };
+    for (int mod_index = 0; mod_index < kModifierCount; ++mod_index) {
+      modifiers[mod_index].assign(1, kModifierKeySyms[mod_index]);
+    }
+  }
+
+  KeySym LookupKeySym(unsigned int keycode, unsigned int state) override {
+    // Shift with level 5 selects no level of the fixture
+    bool shift = (state & ShiftMask);
+    bool level3 = (state & Mod5Mask);
+    bool level5 = (state & Mod3Mask);
+    // Keycodes above 255 cannot be sent by an X server
+    if ((shift && level5) || keycode >= kKeycodeCount) {
+      return NoSymbol;
+    }
+    size_t level = (level5 ? (level3 ? 5 : 4) : (level3 ? 2 : 0) + (shift ? 1 : 0));
+    return keysyms_[keycode][level];
+  }
+
+  bool GetState(KeyboardState *state) override {
+    state->group = group_;
+    state->mods = 0;
+    state->locked_mods = 0;
+    return true;
+  }
+
+  bool GetNames(KeyboardNames *names) override {
+    if (has_names_) {
+      *names = names_;
+    }
+    return has_names_;
+  }
+
+  bool GetGeometry(KeyboardGeometry *geometry) override {
+    return false;
+  }
+
+  bool LockGroup(int group) override {
+    group_ = group;
+    return true;
+  }
+
+  bool SetLayout(const KeyboardNames &names) override {
+    return false;
+  }
+
+  bool SelectEvents(bool state_changes) override {
+    return true;
+  }
+
+  bool WaitForEvent(int timeout_ms, KeyboardEvent *event) override {
+    if (timeout_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    }
+    return false;
+  }
+
+ private:
+  KeySym keysyms_[kKeycodeCount][kLevelCount];
+  KeyboardNames names_;
+  bool has_names_;
+  int group_;
+
+  FakeKeyboardBackend(const FakeKeyboardBackend&) = delete;
+  FakeKeyboardBackend& operator=(const FakeKeyboardBackend&) = delete;
+};
+
+} // namespace
+
+KeyboardBackend* LoadFakeKeyboardBackend(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return NULL;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+
+  FakeKeyboardBackend *backend = new FakeKeyboardBackend();
+  if (!backend->Load(text.str())) {
+    delete backend;
+    return NULL;
+  }
+  return backend;
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,537 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keyboard_backend.h"
+#include "keymap_serialization.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+namespace vscode_keyboard {
+
+namespace {
+
+// Layout:
+//   magic (4 bytes), version (1 byte), records.
+// A record is: stream (1 byte), kind (1 byte), varint microseconds since the
+// previous record, varint payload size, payload. Replies are only recorded when
+// they differ from the last one of their kind, so that replaying them in order
+// rebuilds the backend's state at every event.
+const unsigned char kMagic[4] = {'N', 'K', 'S', 'L'};
+const unsigned char kVersion = 1;
+
+enum RecordKind {
+  // Empty. The first record of every stream.
+  kOpenRecord = 0,
+  // Per modifier: varint count, varint keysyms
+  kModifierMappingRecord = 1,
+  // Varint keycode, varint state, varint keysym
+  kKeySymRecord = 2,
+  // Success byte, varint group, varint mods, varint locked mods
+  kStateRecord = 3,
+  // Success byte, then rules, model, layout, variant and options as varint length plus bytes
+  kNamesRecord = 4,
+  // Type byte, then varint group, mods and locked mods for state changes, or a
+  // change byte, a modifiers changed byte, varint first keycode and keycode
+  // count and a keyboard changed byte
+  kEventRecord = 5,
+  // Success byte, varint width, varint height, varint key count, then per key
+  // varint keycode and zigzag encoded x, y, width and height
+  kGeometryRecord = 6
+};
+
+void WriteString(const std::string &value, std::string *dst) {
+  WriteVarint(value.size(), dst);
+  dst->append(value);
+}
+
+void WriteSignedVarint(int value, std::string *dst) {
+  WriteVarint((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31), dst);
+}
+
+bool ReadSignedVarint(ByteReader *reader, int *value) {
+  uint64_t encoded;
+  if (!reader->ReadVarint(&encoded)) {
+    return false;
+  }
+  *value = static_cast<int>((encoded >> 1) ^ (~(encoded & 1) + 1));
+  return true;
+}
+
+void EncodeState(const KeyboardState &state, std::string *dst) {
+  WriteVarint(state.group, dst);
+  WriteVarint(state.mods, dst);
+  WriteVarint(state.locked_mods, dst);
+}
+
+bool DecodeState(ByteReader *reader, KeyboardState *state) {
+  uint64_t group, mods, locked_mods;
+  if (!reader->ReadVarint(&group) || !reader->ReadVarint(&mods) || !reader->ReadVarint(&locked_mods)) {
+    return false;
+  }
+  state->group = group;
+  state->mods = mods;
+  state->locked_mods = locked_mods;
+  return true;
+}
+
+// The log all recording backends of this process append to.
+class SessionLogWriter {
+ public:
+  // Truncates the file the first time it is opened in this process.
+  static std::shared_ptr<SessionLogWriter> Open(const std::string &path) {
+    static std::mutex instance_mutex;
+    static std::weak_ptr<SessionLogWriter> instance;
+    static bool truncated = false;
+
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    std::shared_ptr<SessionLogWriter> writer = instance.lock();
+    if (writer) {
+      return writer;
+    }
+
+    FILE *file = fopen(path.c_str(), truncated ? "ab" : "wb");
+    if (!file) {
+      return NULL;
+    }
+    if (!truncated) {
+      fwrite(kMagic, 1, sizeof(kMagic), file);
+      fwrite(&kVersion, 1, 1, file);
+      truncated = true;
+    }
+    writer.reset(new SessionLogWriter(file));
+    instance = writer;
+    return writer;
+  }
+
+  ~SessionLogWriter() {
+    fclose(file_);
+  }
+
+  void Write(int stream, RecordKind kind, const std::string &payload) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::string header;
+    header.push_back(static_cast<char>(stream));
+    header.push_back(static_cast<char>(kind));
+    WriteVarint(std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count(), &header);
+    WriteVarint(payload.size(), &header);
+    last_ = now;
+
+    fwrite(header.data(), 1, header.size(), file_);
+    fwrite(payload.data(), 1, payload.size(), file_);
+    // Events are rare, so the log is complete up to the last one even if the process is killed
+    if (kind == kEventRecord) {
+      fflush(file_);
+    }
+  }
+
+ private:
+  explicit SessionLogWriter(FILE *file) : file_(file), last_(std::chrono::steady_clock::now()) {}
+
+  std::mutex mutex_;
+  FILE *file_;
+  std::chrono::steady_clock::time_point last_;
+
+  SessionLogWriter(const SessionLogWriter&) = delete;
+  SessionLogWriter& operator=(const SessionLogWriter&) = delete;
+};
+
+class RecordingKeyboardBackend : public KeyboardBackend {
+ public:
+  RecordingKeyboardBackend(KeyboardBackend *backend, std::shared_ptr<SessionLogWriter> writer, int stream)
+      : backend_(backend), writer_(writer), stream_(stream) {
+    writer_->Write(stream_, kOpenRecord, std::string());
+  }
+
+  void GetModifierMapping(std::vector<KeySym> modifiers[kModifierCount]) override {
+    backend_->GetModifierMapping(modifiers);
+
+    std::string payload;
+    for (int mod_index = 0; mod_index < kModifierCount; ++mod_index) {
+      WriteVarint(modifiers[mod_index].size(), &payload);
+      for (KeySym keysym : modifiers[mod_index]) {
+        WriteVarint(keysym, &payload);
+      }
+    }
+    WriteChanged(kModifierMappingRecord, payload, &last_modifier_mapping_);
+  }
+
+  KeySym LookupKeySym(unsigned int keycode, unsigned int state) override {
+    KeySym keysym = backend_->LookupKeySym(keycode, state);
+
+    uint64_t key = (static_cast<uint64_t>(keycode) << 32) | state;
+    auto it = keysyms_.find(key);
+    if (it == keysyms_.end() || it->second != keysym) {
+      keysyms_[key] = keysym;
+      std::string payload;
+      WriteVarint(keycode, &payload);
+      WriteVarint(state, &payload);
+      WriteVarint(keysym, &payload);
+      writer_->Write(stream_, kKeySymRecord, payload);
+    }
+    return keysym;
+  }
+
+  bool GetState(KeyboardState *state) override {
+    bool result = backend_->GetState(state);
+
+    std::string payload(1, result);
+    if (result) {
+      EncodeState(*state, &payload);
+    }
+    WriteChanged(kStateRecord, payload, &last_state_);
+    return result;
+  }
+
+  bool GetNames(KeyboardNames *names) override {
+    bool result = backend_->GetNames(names);
+
+    std::string payload(1, result);
+    if (result) {
+      WriteString(names->rules, &payload);
+      WriteString(names->model, &payload);
+      WriteString(names->layout, &payload);
+      WriteString(names->variant, &payload);
+      WriteString(names->options, &payload);
+    }
+    WriteChanged(kNamesRecord, payload, &last_names_);
+    return result;
+  }
+
+  bool GetGeometry(KeyboardGeometry *geometry) override {
+    bool result = backend_->GetGeometry(geometry);
+
+    std::string payload(1, result);
+    if (result) {
+      WriteVarint(geometry->width, &payload);
+      WriteVarint(geometry->height, &payload);
+      WriteVarint(geometry->keys.size(), &payload);
+      for (const KeyGeometry &key : geometry->keys) {
+        WriteVarint(key.keycode, &payload);
+        WriteSignedVarint(key.x, &payload);
+        WriteSignedVarint(key.y, &payload);
+        WriteSignedVarint(key.width, &payload);
+        WriteSignedVarint(key.height, &payload);
+      }
+    }
+    WriteChanged(kGeometryRecord, payload, &last_geometry_);
+    return result;
+  }
+
+  // Only the replies that follow are recorded, so a replay ends up in the same state
+  bool LockGroup(int group) override {
+    return backend_->LockGroup(group);
+  }
+
+  bool SetLayout(const KeyboardNames &names) override {
+    return backend_->SetLayout(names);
+  }
+
+  bool SelectEvents(bool state_changes) override {
+    return backend_->SelectEvents(state_changes);
+  }
+
+  bool WaitForEvent(int timeout_ms, KeyboardEvent *event) override {
+    if (!backend_->WaitForEvent(timeout_ms, event)) {
+      return false;
+    }
+
+    std::string payload(1, event->type);
+    if (event->type == KeyboardEvent::kStateChanged) {
+      EncodeState(event->state, &payload);
+    } else {
+      payload.push_back(static_cast<char>(event->change));
+      payload.push_back(event->modifiers_changed);
+      WriteVarint(event->first_keycode, &payload);
+      WriteVarint(event->keycode_count, &payload);
+      payload.push_back(event->keyboard_changed);
+    }
+    writer_->Write(stream_, kEventRecord, payload);
+    return true;
+  }
+
+ private:
+  void WriteChanged(RecordKind kind, const std::string &payload, std::string *last_payload) {
+    if (payload != *last_payload) {
+      *last_payload = payload;
+      writer_->Write(stream_, kind, payload);
+    }
+  }
+
+  std::unique_ptr<KeyboardBackend> backend_;
+  std::shared_ptr<SessionLogWriter> writer_;
+  int stream_;
+  std::unordered_map<uint64_t, KeySym> keysyms_;
+  std::string last_modifier_mapping_;
+  std::string last_state_;
+  std::string last_names_;
+  std::string last_geometry_;
+
+  RecordingKeyboardBackend(const RecordingKeyboardBackend&) = delete;
+  RecordingKeyboardBackend& operator=(const RecordingKeyboardBackend&) = delete;
+};
+
+typedef struct {
+  RecordKind kind;
+  // Microseconds since the stream was opened
+  uint64_t time;
+  std::string payload;
+} SessionRecord;
+
+// Reads the records of `stream`. Returns false if the log is malformed or
+// the stream was never opened.
+bool ReadSessionLog(const std::string &data, int stream, std::vector<SessionRecord> *records) {
+  ByteReader reader(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+  unsigned char magic[4];
+  unsigned char version;
+  if (!reader.ReadBytes(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0
+      || !reader.ReadByte(&version) || version != kVersion) {
+    return false;
+  }
+
+  uint64_t time = 0;
+  uint64_t open_time = 0;
+  bool opened = false;
+  while (!reader.AtEnd()) {
+    unsigned char record_stream, kind;
+    uint64_t delta;
+    std::string payload;
+    if (!reader.ReadByte(&record_stream) || !reader.ReadByte(&kind) || !reader.ReadVarint(&delta) || !reader.ReadString(&payload)) {
+      return false;
+    }
+    time += delta;
+    if (record_stream != stream) {
+      continue;
+    }
+    // Only the first session of a stream is replayed, e.g. of a listener that was restarted
+    if (kind == kOpenRecord) {
+      if (opened) {
+        break;
+      }
+      open_time = time;
+      opened = true;
+    }
+    if (opened) {
+      records->push_back({static_cast<RecordKind>(kind), time - open_time, payload});
+    }
+  }
+  return opened;
+}
+
+class ReplayKeyboardBackend : public KeyboardBackend {
+ public:
+  ReplayKeyboardBackend(std::vector<SessionRecord> *records, bool original_speed)
+      : original_speed_(original_speed), next_record_(0), start_(std::chrono::steady_clock::now()), state_valid_(false), names_valid_(false), geometry_valid_(false) {
+    records_.swap(*records);
+    state_ = {0, 0, 0};
+    ApplyReplies();
+  }
+
+  void GetModifierMapping(std::vector<KeySym> modifiers[kModifierCount]) override {
+    for (int mod_index = 0; mod_index < kModifierCount; ++mod_index) {
+      modifiers[mod_index] = modifiers_[mod_index];
+    }
+  }
+
+  KeySym LookupKeySym(unsigned int keycode, unsigned int state) override {
+    auto it = keysyms_.find((static_cast<uint64_t>(keycode) << 32) | state);
+    return (it != keysyms_.end() ? it->second : NoSymbol);
+  }
+
+  bool GetState(KeyboardState *state) override {
+    *state = state_;
+    return state_valid_;
+  }
+
+  bool GetNames(KeyboardNames *names) override {
+    *names = names_;
+    return names_valid_;
+  }
+
+  bool GetGeometry(KeyboardGeometry *geometry) override {
+    *geometry = geometry_;
+    return geometry_valid_;
+  }
+
+  bool LockGroup(int group) override {
+    return false;
+  }
+
+  bool SetLayout(const KeyboardNames &names) override {
+    return false;
+  }
+
+  bool SelectEvents(bool state_changes) override {
+    return true;
+  }
+
+  bool WaitForEvent(int timeout_ms, KeyboardEvent *event) override {
+    std::chrono::milliseconds timeout(timeout_ms > 0 ? timeout_ms : 0);
+    if (next_record_ == records_.size()) {
+      std::this_thread::sleep_for(timeout);
+      return false;
+    }
+
+    const SessionRecord &record = records_[next_record_];
+    if (original_speed_) {
+      std::chrono::steady_clock::time_point due = start_ + std::chrono::microseconds(record.time);
+      if (due > std::chrono::steady_clock::now() + timeout) {
+        std::this_thread::sleep_for(timeout);
+        return false;
+      }
+      std::this_thread::sleep_until(due);
+    }
+
+    ++next_record_;
+    bool decoded = DecodeEvent(record.payload, event);
+    // The replies recorded while the event was handled
+    ApplyReplies();
+    return decoded;
+  }
+
+ private:
+  bool DecodeEvent(const std::string &payload, KeyboardEvent *event) {
+    ByteReader reader(reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+    unsigned char type, change, modifiers_changed;
+    if (!reader.ReadByte(&type)) {
+      return false;
+    }
+    if (type == KeyboardEvent::kStateChanged) {
+      event->type = KeyboardEvent::kStateChanged;
+      return DecodeState(&reader, &event->state);
+    }
+
+    uint64_t first_keycode, keycode_count;
+    if (!reader.ReadByte(&change) || !reader.ReadByte(&modifiers_changed)
+        || !reader.ReadVarint(&first_keycode) || !reader.ReadVarint(&keycode_count)) {
+      return false;
+    }
+    event->type = KeyboardEvent::kMappingChanged;
+    event->change = static_cast<KeyMapChange>(change);
+    event->modifiers_changed = modifiers_changed;
+    event->first_keycode = first_keycode;
+    event->keycode_count = keycode_count;
+    unsigned char keyboard_changed;
+    event->keyboard_changed = (reader.ReadByte(&keyboard_changed) && keyboard_changed);
+    return true;
+  }
+
+  bool DecodeGeometry(ByteReader *reader, KeyboardGeometry *geometry) {
+    uint64_t width, height, count;
+    if (!reader->ReadVarint(&width) || !reader->ReadVarint(&height) || !reader->ReadVarint(&count)) {
+      return false;
+    }
+    geometry->width = width;
+    geometry->height = height;
+    geometry->keys.clear();
+    for (; count > 0; --count) {
+      uint64_t keycode;
+      KeyGeometry key;
+      if (!reader->ReadVarint(&keycode) || !ReadSignedVarint(reader, &key.x) || !ReadSignedVarint(reader, &key.y)
+          || !ReadSignedVarint(reader, &key.width) || !ReadSignedVarint(reader, &key.height)) {
+        return false;
+      }
+      key.keycode = keycode;
+      geometry->keys.push_back(key);
+    }
+    return true;
+  }
+
+  // Applies the replies up to the next event.
+  void ApplyReplies() {
+    for (; next_record_ < records_.size() && records_[next_record_].kind != kEventRecord; ++next_record_) {
+      const std::string &payload = records_[next_record_].payload;
+      ByteReader reader(reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+      unsigned char success;
+      switch (records_[next_record_].kind) {
+        case kModifierMappingRecord:
+          for (int mod_index = 0; mod_index < kModifierCount; ++mod_index) {
+            uint64_t count, keysym;
+            modifiers_[mod_index].clear();
+            for (reader.ReadVarint(&count); count > 0 && reader.ReadVarint(&keysym); --count) {
+              modifiers_[mod_index].push_back(keysym);
+            }
+          }
+          break;
+        case kKeySymRecord: {
+          uint64_t keycode, state, keysym;
+          if (reader.ReadVarint(&keycode) && reader.ReadVarint(&state) && reader.ReadVarint(&keysym)) {
+            keysyms_[(keycode << 32) | state] = keysym;
+          }
+          break;
+        }
+        case kStateRecord:
+          state_valid_ = (reader.ReadByte(&success) && success && DecodeState(&reader, &state_));
+          break;
+        case kNamesRecord:
+          names_valid_ = (reader.ReadByte(&success) && success
+                          && reader.ReadString(&names_.rules) && reader.ReadString(&names_.model)
+                          && reader.ReadString(&names_.layout) && reader.ReadString(&names_.variant)
+                          && reader.ReadString(&names_.options));
+          break;
+        case kGeometryRecord:
+          geometry_valid_ = (reader.ReadByte(&success) && success && DecodeGeometry(&reader, &geometry_));
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  std::vector<SessionRecord> records_;
+  bool original_speed_;
+  size_t next_record_;
+  std::chrono::steady_clock::time_point start_;
+
+  // The replies recorded so far
+  std::vector<KeySym> modifiers_[kModifierCount];
+  std::unordered_map<uint64_t, KeySym> keysyms_;
+  KeyboardState state_;
+  bool state_valid_;
+  KeyboardNames names_;
+  bool names_valid_;
+  KeyboardGeometry geometry_;
+  bool geometry_valid_;
+
+  ReplayKeyboardBackend(const ReplayKeyboardBackend&) = delete;
+  ReplayKeyboardBackend& operator=(const ReplayKeyboardBackend&) = delete;
+};
+
+} // namespace
+
+KeyboardBackend* CreateRecordingKeyboardBackend(KeyboardBackend *backend, const std::string &path, int stream) {
+  std::shared_ptr<SessionLogWriter> writer = SessionLogWriter::Open(path);
+  if (!writer) {
+    return backend;
+  }
+  return new RecordingKeyboardBackend(backend, writer, stream);
+}
+
+KeyboardBackend* LoadReplayKeyboardBackend(const std::string &path, int stream, bool original_speed) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return NULL;
+  }
+  std::stringstream data;
+  data << file.rdbuf();
+
+  std::vector<SessionRecord> records;
+  if (!ReadSessionLog(data.str(), stream, &records)) {
+    return NULL;
+  }
+  return new ReplayKeyboardBackend(&records, original_speed);
+}
+
+}  // namespace vscode_keyboard
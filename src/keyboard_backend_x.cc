@@ -0,0 +1,388 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keyboard_backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <X11/XKBlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XKBgeom.h>
+#include <X11/extensions/XKBrules.h>
+
+namespace vscode_keyboard {
+
+namespace {
+
+bool KeyNamesEqual(const char *a, const char *b) {
+  return strncmp(a, b, XkbKeyNameLength) == 0;
+}
+
+// Resolves the aliases of the keycodes and of the geometry. Returns 0 for unknown names.
+unsigned int FindKeycode(XkbDescPtr xkb, const char *name) {
+  for (int i = 0; i < xkb->names->num_key_aliases; ++i) {
+    if (KeyNamesEqual(xkb->names->key_aliases[i].alias, name)) {
+      name = xkb->names->key_aliases[i].real;
+      break;
+    }
+  }
+  for (int i = 0; i < xkb->geom->num_key_aliases; ++i) {
+    if (KeyNamesEqual(xkb->geom->key_aliases[i].alias, name)) {
+      name = xkb->geom->key_aliases[i].real;
+      break;
+    }
+  }
+  for (unsigned int keycode = xkb->min_key_code; keycode <= xkb->max_key_code; ++keycode) {
+    if (KeyNamesEqual(xkb->names->keys[keycode].name, name)) {
+      return keycode;
+    }
+  }
+  return 0;
+}
+
+// Where xkeyboard-config is installed, e.g. under /usr/local on the BSDs
+const char* const kConfigRoots[] = {"/usr/share/X11/xkb", "/usr/local/share/X11/xkb", "/usr/X11R7/lib/X11/xkb"};
+const char kDefaultRules[] = "evdev";
+
+// Looks up rules files that are not given as a path like setxkbmap does, in
+// $XKB_CONFIG_ROOT if it is set and else in the first root that has them.
+std::string GetRulesPath(const std::string &rules) {
+  if (rules.find('/') != std::string::npos) {
+    return rules;
+  }
+  const char *root = getenv("XKB_CONFIG_ROOT");
+  if (root && root[0]) {
+    return std::string(root) + "/rules/" + rules;
+  }
+  for (const char *candidate : kConfigRoots) {
+    std::string path = std::string(candidate) + "/rules/" + rules;
+    if (access(path.c_str(), R_OK) == 0) {
+      return path;
+    }
+  }
+  return std::string(kConfigRoots[0]) + "/rules/" + rules;
+}
+
+// The var defs point into `names`, which has to outlive them.
+void InitVarDefs(KeyboardNames *names, XkbRF_VarDefsRec *var_defs) {
+  memset(var_defs, 0, sizeof(*var_defs));
+  var_defs->model = (names->model.empty() ? NULL : &names->model[0]);
+  var_defs->layout = (names->layout.empty() ? NULL : &names->layout[0]);
+  var_defs->variant = (names->variant.empty() ? NULL : &names->variant[0]);
+  var_defs->options = (names->options.empty() ? NULL : &names->options[0]);
+}
+
+KeyMapChange ClassifyMapChange(const XkbMapNotifyEvent *event) {
+  // Key types, virtual modifiers and the modifier map can change the level of every key
+  unsigned int full_change_mask = XkbKeyTypesMask | XkbModifierMapMask | XkbVirtualModsMask | XkbVirtualModMapMask;
+  if (event->changed & full_change_mask) {
+    return kKeyMapFullyChanged;
+  }
+  if ((event->changed & XkbKeySymsMask) && event->num_key_syms > 0) {
+    return kKeyMapKeySymsChanged;
+  }
+  return kKeyMapUnchanged;
+}
+
+// Lays out the keys of `geometry` like xkbprint: the keys of a row follow each
+// other, each after its gap. Section rotations are not applied.
+void ComputeKeyGeometries(XkbDescPtr xkb, KeyboardGeometry *geometry) {
+  XkbGeometryPtr geom = xkb->geom;
+  geometry->width = geom->width_mm;
+  geometry->height = geom->height_mm;
+  geometry->keys.clear();
+
+  for (int section_index = 0; section_index < geom->num_sections; ++section_index) {
+    XkbSectionPtr section = &geom->sections[section_index];
+    for (int row_index = 0; row_index < section->num_rows; ++row_index) {
+      XkbRowPtr row = &section->rows[row_index];
+      int offset = 0;
+      for (int key_index = 0; key_index < row->num_keys; ++key_index) {
+        XkbKeyPtr key = &row->keys[key_index];
+        XkbShapePtr shape = &geom->shapes[key->shape_ndx];
+        XkbComputeShapeBounds(shape);
+        offset += key->gap;
+
+        KeyGeometry key_geometry;
+        key_geometry.keycode = FindKeycode(xkb, key->name.name);
+        key_geometry.x = section->left + row->left + (row->vertical ? 0 : offset) + shape->bounds.x1;
+        key_geometry.y = section->top + row->top + (row->vertical ? offset : 0) + shape->bounds.y1;
+        key_geometry.width = shape->bounds.x2 - shape->bounds.x1;
+        key_geometry.height = shape->bounds.y2 - shape->bounds.y1;
+        if (key_geometry.keycode) {
+          geometry->keys.push_back(key_geometry);
+        }
+
+        offset += (row->vertical ? shape->bounds.y2 : shape->bounds.x2);
+      }
+    }
+  }
+}
+
+class XlibKeyboardBackend : public KeyboardBackend {
+ public:
+  explicit XlibKeyboardBackend(Display *display) : display_(display) {
+    memset(&key_event_, 0, sizeof(key_event_));
+    key_event_.xkey.display = display;
+    key_event_.xkey.type = KeyPress;
+
+    int opcode = 0;
+    int xkb_base_error_code = 0;
+    int xkblib_major = XkbMajorVersion;
+    int xkblib_minor = XkbMinorVersion;
+    has_xkb_ = (XkbLibraryVersion(&xkblib_major, &xkblib_minor)
+                && XkbQueryExtension(display, &opcode, &xkb_base_event_code_, &xkb_base_error_code, &xkblib_major, &xkblib_minor));
+  }
+
+  ~XlibKeyboardBackend() override {
+    XFlush(display_);
+    XCloseDisplay(display_);
+  }
+
+  void GetModifierMapping(std::vector<KeySym> modifiers[kModifierCount]) override {
+    XModifierKeymap* mod_map = XGetModifierMapping(display_);
+    int max_mod_keys = mod_map->max_keypermod;
+    for (int mod_index = 0; mod_index < kModifierCount; ++mod_index) {
+      modifiers[mod_index].clear();
+      for (int key_index = 0; key_index < max_mod_keys; ++key_index) {
+        int key = mod_map->modifiermap[mod_index * max_mod_keys + key_index];
+        if (!key) {
+          continue;
+        }
+
+        KeySym keysym = XkbKeycodeToKeysym(display_, key, 0, 0);
+        if (keysym) {
+          modifiers[mod_index].push_back(keysym);
+        }
+      }
+    }
+    XFreeModifiermap(mod_map);
+  }
+
+  KeySym LookupKeySym(unsigned int keycode, unsigned int state) override {
+    // Xlib would look up the low byte of keycodes above 255, which the server cannot send
+    if (keycode > 255) {
+      return NoSymbol;
+    }
+    key_event_.xkey.keycode = keycode;
+    key_event_.xkey.state = state;
+    KeySym keysym = XK_VoidSymbol;
+    XLookupString(&key_event_.xkey, NULL, 0, &keysym, NULL);
+    return keysym;
+  }
+
+  bool GetState(KeyboardState *state) override {
+    // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#determining_keyboard_state
+    XkbStateRec xkb_state;
+    if (XkbGetState(display_, XkbUseCoreKbd, &xkb_state) != Success) {
+      return false;
+    }
+    state->group = xkb_state.group;
+    state->mods = xkb_state.mods;
+    state->locked_mods = xkb_state.locked_mods;
+    return true;
+  }
+
+  bool GetNames(KeyboardNames *names) override {
+    XkbRF_VarDefsRec vdr;
+    memset(&vdr, 0, sizeof(vdr));
+    char *tmp = NULL;
+    bool res = XkbRF_GetNamesProp(display_, &tmp, &vdr);
+    if (res) {
+      names->model = (vdr.model ? vdr.model : "");
+      names->layout = (vdr.layout ? vdr.layout : "");
+      names->variant = (vdr.variant ? vdr.variant : "");
+      names->options = (vdr.options ? vdr.options : "");
+      names->rules = (tmp ? tmp : "");
+    }
+
+    // The names are allocated by XkbRF_GetNamesProp
+    free(tmp);
+    free(vdr.model);
+    free(vdr.layout);
+    free(vdr.variant);
+    free(vdr.options);
+    return res;
+  }
+
+  bool GetGeometry(KeyboardGeometry *geometry) override {
+    if (!has_xkb_) {
+      return false;
+    }
+
+    XkbDescPtr xkb = XkbGetMap(display_, 0, XkbUseCoreKbd);
+    if (!xkb) {
+      return false;
+    }
+    bool result = (XkbGetNames(display_, XkbKeyNamesMask | XkbKeyAliasesMask, xkb) == Success
+                   && XkbGetGeometry(display_, xkb) == Success && xkb->names && xkb->geom);
+    if (result) {
+      ComputeKeyGeometries(xkb, geometry);
+    }
+    XkbFreeKeyboard(xkb, 0, True);
+    return result;
+  }
+
+  bool LockGroup(int group) override {
+    if (!has_xkb_ || !XkbLockGroup(display_, XkbUseCoreKbd, group)) {
+      return false;
+    }
+    // The server wraps groups the keymap does not have into its range
+    XkbStateRec xkb_state;
+    return (XkbGetState(display_, XkbUseCoreKbd, &xkb_state) == Success && xkb_state.locked_group == group);
+  }
+
+  bool SetLayout(const KeyboardNames &names) override {
+    if (!has_xkb_) {
+      return false;
+    }
+
+    KeyboardNames new_names = names;
+    if (new_names.rules.empty()) {
+      new_names.rules = kDefaultRules;
+    }
+    std::string rules_path = GetRulesPath(new_names.rules);
+    XkbRF_RulesPtr rules = XkbRF_Load(&rules_path[0], const_cast<char*>("C"), True, True);
+    if (!rules) {
+      return false;
+    }
+
+    XkbRF_VarDefsRec var_defs;
+    InitVarDefs(&new_names, &var_defs);
+    XkbComponentNamesRec components;
+    memset(&components, 0, sizeof(components));
+    bool result = XkbRF_GetComponents(rules, &var_defs, &components);
+    if (result) {
+      // The names are set before the keymap is loaded, so that a client
+      // handling the `XkbNewKeyboardNotify` already reads the new ones
+      KeyboardNames old_names;
+      bool has_old_names = GetNames(&old_names);
+      XkbRF_SetNamesProp(display_, &new_names.rules[0], &var_defs);
+
+      // Like setxkbmap, which keeps the geometry if it cannot be loaded
+      XkbDescPtr xkb = XkbGetKeyboardByName(display_, XkbUseCoreKbd, &components, XkbGBN_AllComponentsMask,
+                                            XkbGBN_AllComponentsMask & ~XkbGBN_GeometryMask, True);
+      result = (xkb != NULL);
+      if (xkb) {
+        XkbFreeKeyboard(xkb, XkbAllComponentsMask, True);
+      } else if (has_old_names) {
+        XkbRF_VarDefsRec old_var_defs;
+        InitVarDefs(&old_names, &old_var_defs);
+        XkbRF_SetNamesProp(display_, old_names.rules.empty() ? NULL : &old_names.rules[0], &old_var_defs);
+      }
+      XFlush(display_);
+    }
+
+    // The components are allocated by XkbRF_GetComponents
+    free(components.keymap);
+    free(components.keycodes);
+    free(components.types);
+    free(components.compat);
+    free(components.symbols);
+    free(components.geometry);
+    XkbRF_Free(rules, True);
+    return result;
+  }
+
+  bool SelectEvents(bool state_changes) override {
+    if (!has_xkb_) {
+      return false;
+    }
+
+    // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#xkb_event_types
+    // `XkbStateNotify` reports layout and group switches, `XkbMapNotify` and
+    // `XkbNewKeyboardNotify` report keymap changes (e.g. from xmodmap)
+    unsigned int selected_events = XkbMapNotifyMask | XkbNewKeyboardNotifyMask;
+    if (state_changes) {
+      selected_events |= XkbStateNotifyMask;
+    }
+    XkbSelectEvents(display_, XkbUseCoreKbd, XkbAllEventsMask, selected_events);
+    return true;
+  }
+
+  bool WaitForEvent(int timeout_ms, KeyboardEvent *event) override {
+    if (timeout_ms > 0 && !XPending(display_)) {
+      // See https://stackoverflow.com/a/8592969 which explains
+      // the technique of waiting for an XEvent with a timeout
+      int x11_fd = ConnectionNumber(display_);
+      fd_set in_fds;
+      FD_ZERO(&in_fds);
+      FD_SET(x11_fd, &in_fds);
+
+      struct timeval tv;
+      tv.tv_sec = timeout_ms / 1000;
+      tv.tv_usec = (timeout_ms % 1000) * 1000;
+      select(x11_fd + 1, &in_fds, NULL, NULL, &tv);
+    }
+
+    while (XPending(display_)) {
+      XkbEvent xkb_event;
+      XNextEvent(display_, &xkb_event.core);
+      if (TranslateEvent(&xkb_event, event)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  bool TranslateEvent(XkbEvent *xkb_event, KeyboardEvent *event) {
+    event->type = KeyboardEvent::kMappingChanged;
+    event->change = kKeyMapFullyChanged;
+    event->modifiers_changed = true;
+    event->first_keycode = 0;
+    event->keycode_count = 0;
+    event->keyboard_changed = false;
+
+    if (xkb_event->type == MappingNotify) {
+      XRefreshKeyboardMapping(&xkb_event->core.xmapping);
+      return true;
+    }
+    if (!has_xkb_ || xkb_event->type != xkb_base_event_code_) {
+      return false;
+    }
+
+    switch (xkb_event->any.xkb_type) {
+      case XkbStateNotify:
+        event->type = KeyboardEvent::kStateChanged;
+        event->state.group = xkb_event->state.group;
+        event->state.mods = xkb_event->state.mods;
+        event->state.locked_mods = xkb_event->state.locked_mods;
+        return true;
+      case XkbMapNotify:
+        XkbRefreshKeyboardMapping(&xkb_event->map);
+        event->change = ClassifyMapChange(&xkb_event->map);
+        event->modifiers_changed = (xkb_event->map.changed & XkbModifierMapMask);
+        event->first_keycode = xkb_event->map.first_key_sym;
+        event->keycode_count = xkb_event->map.num_key_syms;
+        return true;
+      case XkbNewKeyboardNotify:
+        event->keyboard_changed = true;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  Display *display_;
+  bool has_xkb_;
+  int xkb_base_event_code_;
+  // Reused for every lookup
+  XEvent key_event_;
+
+  XlibKeyboardBackend(const XlibKeyboardBackend&) = delete;
+  XlibKeyboardBackend& operator=(const XlibKeyboardBackend&) = delete;
+};
+
+} // namespace
+
+KeyboardBackend* CreateXlibKeyboardBackend(Display *display) {
+  return new XlibKeyboardBackend(display);
+}
+
+}  // namespace vscode_keyboard
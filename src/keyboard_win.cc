@@ -469,8 +469,114 @@ void DisposeKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data) {
   listener->Release();
 }
 
+void RegisterModifierStateListenerImpl(NotificationCallbackData *data) {
+}
+
+void DisposeModifierStateListenerImpl(NotificationCallbackData *data) {
+}
+
 napi_value IsISOKeyboardImpl(napi_env env, napi_callback_info info) {
   return napi_fetch_undefined(env);
 }
 
+napi_value GetKeyMapDiffImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SetConnectionOptionsImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetKeyMapFastImpl(napi_env env, napi_callback_info info) {
+  // The keymap is computed without any round trips, so it is fast already
+  return GetKeyMapImpl(env, info);
+}
+
+napi_value GetKeyboardSnapshotImpl(napi_env env, napi_callback_info info) {
+  // Read first, so that a change while reading the rest is reported again
+  uint64_t epoch = GetLayoutEpoch();
+  napi_value layout = GetCurrentKeyboardLayoutImpl(env, info);
+  napi_value key_map = GetKeyMapImpl(env, info);
+  napi_value is_iso_keyboard = IsISOKeyboardImpl(env, info);
+  if (layout == NULL || key_map == NULL || is_iso_keyboard == NULL) {
+    return NULL;
+  }
+
+  napi_value result;
+  NAPI_CALL(env, CreateKeyboardSnapshotObject(env, epoch, layout, key_map, is_iso_keyboard, &result));
+  return result;
+}
+
+napi_value SetKeyMapCacheDirectoryImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value PublishSharedKeyMapImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SubscribeSharedKeyMapImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SerializeKeyMapImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value DeserializeKeyMapImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetKeyMapFingerprintImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value TranslateKeysImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetKeyClassesImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetComposeResultImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value FindComposeSequencesImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetModifierStateImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetKeyboardTypeImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetKeyboardGeometryImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SetKeyboardGroupImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SetKeyboardLayoutImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value SetKeybindingsImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
+napi_value ResolveKeybindingsImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_null(env);
+}
+
+napi_value IdentifyLayoutImpl(napi_env env, napi_callback_info info) {
+  return napi_fetch_undefined(env);
+}
+
 }  // namespace vscode_keyboard
@@ -4,60 +4,83 @@
  *--------------------------------------------------------------------------------------------*/
 
 #include "keymapping.h"
+#include "keybinding_resolver.h"
+#include "keyboard_backend.h"
+#include "keymap.h"
+#include "keymap_cache.h"
+#include "keymap_shm.h"
+#include "keymap_serialization.h"
+#include "layout_identification.h"
+#include "compose_table.h"
 #include "string_conversion.h"
 #include "common.h"
 
-#include <X11/XKBlib.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
-#include <X11/extensions/XKBrules.h>
+#include <X11/extensions/XKB.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include "../deps/chromium/macros.h"
 #include "../deps/chromium/x/keysym_to_unicode.h"
 
 typedef struct _XDisplay XDisplay;
 
+using vscode_keyboard::KeyboardBackend;
+using vscode_keyboard::KeyboardEvent;
+using vscode_keyboard::KeyboardGeometry;
+using vscode_keyboard::KeyboardNames;
+using vscode_keyboard::KeyboardState;
+using vscode_keyboard::KeyMap;
+
 namespace {
 
 class KeyModifierMaskToXModifierMask {
  public:
-  static KeyModifierMaskToXModifierMask& GetInstance() {
-    static KeyModifierMaskToXModifierMask instance;
-    return instance;
-  }
-
-  void Initialize(Display* display) {
-    alt_modifier_ = 0;
-    meta_modifier_ = 0;
-    num_lock_modifier_ = 0;
-    mode_switch_modifier_ = 0;
-    level3_modifier_ = 0;  // AltGr is often mapped to the level3 modifier
-    level5_modifier_ = 0;  // AltGr is mapped to the level5 modifier in the Neo layout family
+  KeyModifierMaskToXModifierMask() {
+    ResetModifiers();
     effective_group_index_ = 0;
+  }
 
-    if (!display) {
+  // Reads the effective group and, unless it is still cached, the modifier mapping.
+  void Initialize(KeyboardBackend* backend) {
+    if (!backend) {
+      ResetModifiers();
+      effective_group_index_ = 0;
       return;
     }
 
-    // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#determining_keyboard_state
-    XkbStateRec xkb_state;
-    XkbGetState(display, XkbUseCoreKbd, &xkb_state);
-    effective_group_index_ = xkb_state.group;
+    KeyboardState state;
+    UpdateGroup(backend->GetState(&state) ? state.group : 0);
 
-    XModifierKeymap* mod_map = XGetModifierMapping(display);
-    int max_mod_keys = mod_map->max_keypermod;
-    for (int mod_index = 0; mod_index <= 8; ++mod_index) {
-      for (int key_index = 0; key_index < max_mod_keys; ++key_index) {
-        int key = mod_map->modifiermap[mod_index * max_mod_keys + key_index];
-        if (!key) {
-          continue;
-        }
+    EnsureModifiers(backend);
+  }
 
-        int keysym = XkbKeycodeToKeysym(display, key, 0, 0);
-        if (!keysym) {
-          continue;
-        }
+  // The modifier mapping rarely changes, so it is only fetched again after it
+  // was invalidated because of a `MappingNotify` or `XkbNewKeyboardNotify`.
+  void EnsureModifiers(KeyboardBackend* backend) {
+    if (modifiers_valid_) {
+      return;
+    }
+    ResetModifiers();
 
+    std::vector<KeySym> mod_map[KeyboardBackend::kModifierCount];
+    backend->GetModifierMapping(mod_map);
+    for (int mod_index = 0; mod_index < KeyboardBackend::kModifierCount; ++mod_index) {
+      for (KeySym keysym : mod_map[mod_index]) {
         if (keysym == XK_Alt_L || keysym == XK_Alt_R) {
           alt_modifier_ = 1 << mod_index;
         }
@@ -79,9 +102,25 @@ class KeyModifierMaskToXModifierMask {
       }
     }
 
-    XFreeModifiermap(mod_map);
+    modifiers_valid_ = true;
+  }
+
+  void InvalidateModifiers() {
+    modifiers_valid_ = false;
+  }
+
+  // The group is part of every `XkbStateNotify`, so it can be kept up to date without a round trip.
+  void UpdateGroup(int effective_group_index) {
+    effective_group_index_ = effective_group_index;
   }
 
+  int alt_modifier() const { return alt_modifier_; }
+  int meta_modifier() const { return meta_modifier_; }
+  int num_lock_modifier() const { return num_lock_modifier_; }
+  int mode_switch_modifier() const { return mode_switch_modifier_; }
+  int level3_modifier() const { return level3_modifier_; }
+  int level5_modifier() const { return level5_modifier_; }
+
   int XStateFromKeyMod(int keyMod) {
     int x_modifier = 0;
 
@@ -121,10 +160,17 @@ class KeyModifierMaskToXModifierMask {
   }
 
  private:
-  KeyModifierMaskToXModifierMask() {
-    Initialize(NULL);
+  void ResetModifiers() {
+    alt_modifier_ = 0;
+    meta_modifier_ = 0;
+    num_lock_modifier_ = 0;
+    mode_switch_modifier_ = 0;
+    level3_modifier_ = 0;  // AltGr is often mapped to the level3 modifier
+    level5_modifier_ = 0;  // AltGr is mapped to the level5 modifier in the Neo layout family
+    modifiers_valid_ = false;
   }
 
+  bool modifiers_valid_;
   int alt_modifier_;
   int meta_modifier_;
   int num_lock_modifier_;
@@ -137,10 +183,39 @@ class KeyModifierMaskToXModifierMask {
   KeyModifierMaskToXModifierMask& operator=(const KeyModifierMaskToXModifierMask&) = delete;
 };
 
-std::string GetStrFromXEvent(const XEvent* xev) {
-  const XKeyEvent* xkey = &xev->xkey;
-  KeySym keysym = XK_VoidSymbol;
-  XLookupString(const_cast<XKeyEvent*>(xkey), NULL, 0, &keysym, NULL);
+// Key classes reported by `getKeyClasses`, one bit each
+enum KeyClass {
+  kPrintableKeyClass = 1 << 0,
+  kDeadKeyClass = 1 << 1,
+  kModifierKeyClass = 1 << 2,
+  kFunctionKeyClass = 1 << 3,
+  kKeypadKeyClass = 1 << 4
+};
+const int kKeyClassBits = 5;
+
+int ClassifyKeySym(KeySym keysym) {
+  // XK_dead_grave .. XK_dead_longsolidusoverlay
+  if (keysym >= 0xfe50 && keysym <= 0xfe93) {
+    return kDeadKeyClass;
+  }
+
+  int key_class = 0;
+  if (ui::GetUnicodeCharacterFromXKeySym(keysym)) {
+    key_class |= kPrintableKeyClass;
+  }
+  if (IsModifierKey(keysym)) {
+    key_class |= kModifierKeyClass;
+  }
+  if (IsFunctionKey(keysym) || IsMiscFunctionKey(keysym) || IsCursorKey(keysym)) {
+    key_class |= kFunctionKeyClass;
+  }
+  if (IsKeypadKey(keysym) || IsPFKey(keysym)) {
+    key_class |= kKeypadKeyClass;
+  }
+  return key_class;
+}
+
+std::string GetStrFromKeySym(KeySym keysym) {
   uint16_t character = ui::GetUnicodeCharacterFromXKeySym(keysym);
 
   if (!character)
@@ -151,135 +226,385 @@ std::string GetStrFromXEvent(const XEvent* xev) {
   return vscode_keyboard::UTF16toUTF8(&value, 1);
 }
 
-} // namespace
+// Opens displays on a background thread, so that an unreachable `DISPLAY` can
+// only block the caller for the configured timeout. Failed attempts are
+// remembered and not retried before an exponentially growing backoff expires.
+// It is guarded by the lock its callers pass in.
+class DisplayConnector {
+ public:
+  DisplayConnector() : timeout_ms_(kDefaultTimeoutMs), max_backoff_ms_(kDefaultMaxBackoffMs), backoff_ms_(0) {}
 
+  // Negative values keep the current setting.
+  void Configure(int timeout_ms, int max_backoff_ms) {
+    if (timeout_ms >= 0) {
+      timeout_ms_ = timeout_ms;
+    }
+    if (max_backoff_ms >= 0) {
+      max_backoff_ms_ = max_backoff_ms;
+    }
+  }
 
-namespace vscode_keyboard {
+  // Returns NULL while the backoff of a failed attempt has not expired yet.
+  // `lock` is released while waiting for the attempt, so callers have to
+  // check again afterwards what it guards. Of several callers waiting for the
+  // same attempt, the first one to take `lock` back settles it and receives
+  // the display, which it has to put in place before releasing `lock`. The
+  // others receive NULL once the attempt is settled and find it there.
+  Display* Connect(std::unique_lock<std::mutex> *lock) {
+    std::shared_ptr<PendingConnection> pending = pending_;
+    if (!pending) {
+      if (std::chrono::steady_clock::now() < retry_after_) {
+        return NULL;
+      }
+      pending = Start();
+    }
 
-#define DOM_CODE(usb, evdev, xkb, win, mac, code, id) {usb, xkb, code}
-#define DOM_CODE_DECLARATION const KeycodeMapEntry usb_keycode_map[] =
-#include "../deps/chromium/dom_code_data.inc"
-#undef DOM_CODE
-#undef DOM_CODE_DECLARATION
+    lock->unlock();
+    {
+      std::unique_lock<std::mutex> pending_lock(pending->mutex);
+      pending->done_cv.wait_until(pending_lock, pending->deadline, [&pending] { return pending->done; });
+    }
+    lock->lock();
 
-napi_value GetKeyMapImpl(napi_env env, napi_callback_info info) {
+    if (pending_ != pending) {
+      return NULL;
+    }
 
-  napi_value result;
-  NAPI_CALL(env, napi_create_object(env, &result));
+    Display *display = NULL;
+    {
+      std::lock_guard<std::mutex> pending_lock(pending->mutex);
+      if (pending->done) {
+        std::swap(display, pending->display);
+      } else {
+        // The attempt closes the display itself if it still completes
+        pending->abandoned = true;
+      }
+    }
+    pending_.reset();
+    if (display) {
+      backoff_ms_ = 0;
+    } else {
+      RecordFailure();
+    }
+    return display;
+  }
 
-  Display *display;
-  if (!(display = XOpenDisplay(""))) {
-    return result;
+ private:
+  static const int kDefaultTimeoutMs = 2000;
+  static const int kDefaultMaxBackoffMs = 60000;
+  static const int kInitialBackoffMs = 500;
+
+  struct PendingConnection {
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    std::chrono::steady_clock::time_point deadline;
+    bool done = false;
+    // Nobody waits for the attempt anymore
+    bool abandoned = false;
+    // Until the caller that settles the attempt takes it
+    Display *display = NULL;
+  };
+
+  std::shared_ptr<PendingConnection> Start() {
+    std::shared_ptr<PendingConnection> pending = std::make_shared<PendingConnection>();
+    pending->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms_);
+    pending_ = pending;
+    std::thread([pending] {
+      Display *display = XOpenDisplay("");
+      std::lock_guard<std::mutex> lock(pending->mutex);
+      if (pending->abandoned && display) {
+        XCloseDisplay(display);
+        display = NULL;
+      }
+      pending->display = display;
+      pending->done = true;
+      pending->done_cv.notify_all();
+    }).detach();
+    return pending;
   }
 
-  XEvent event;
-  memset(&event, 0, sizeof(XEvent));
-  XKeyEvent* key_event = &event.xkey;
-  key_event->display = display;
-  key_event->type = KeyPress;
+  void RecordFailure() {
+    backoff_ms_ = (backoff_ms_ == 0 ? kInitialBackoffMs : std::min(backoff_ms_ * 2, max_backoff_ms_));
+    retry_after_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff_ms_);
+  }
 
-  KeyModifierMaskToXModifierMask *mask_provider = &KeyModifierMaskToXModifierMask::GetInstance();
-  mask_provider->Initialize(display);
+  int timeout_ms_;
+  int max_backoff_ms_;
+  int backoff_ms_;
+  std::chrono::steady_clock::time_point retry_after_;
+  // The attempt in progress, which every caller waits for
+  std::shared_ptr<PendingConnection> pending_;
 
-  size_t cnt = sizeof(usb_keycode_map) / sizeof(usb_keycode_map[0]);
+  DisplayConnector(const DisplayConnector&) = delete;
+  DisplayConnector& operator=(const DisplayConnector&) = delete;
+};
 
-  for (size_t i = 0; i < cnt; ++i) {
-    const char *code = usb_keycode_map[i].code;
-    int native_keycode = usb_keycode_map[i].native_keycode;
+// The streams of a session log, one for each backend a process opens
+enum KeyboardBackendStream {
+  kSharedBackendStream = 0,
+  kListenerBackendStream = 1
+};
 
-    if (!code || native_keycode <= 0) {
-      continue;
-    }
+const char* GetEnvironmentPath(const char *name) {
+  const char *path = getenv(name);
+  return (path && *path ? path : NULL);
+}
 
-    napi_value entry;
-    NAPI_CALL(env, napi_create_object(env, &entry));
+// Opens the X server's keyboard, with `connect` opening the display, unless
+//  - NATIVE_KEYMAP_REPLAY is set to a session log, which is replayed at the
+//    recorded speed or, if NATIVE_KEYMAP_REPLAY_SPEED is `max`, without delays
+//  - NATIVE_KEYMAP_FIXTURE is set to a fixture like test/linux/en.txt, whose layout is served
+// If NATIVE_KEYMAP_RECORD is set, the session is recorded into a log at that path.
+template <typename Connect>
+KeyboardBackend* OpenKeyboardBackend(KeyboardBackendStream stream, Connect connect) {
+  KeyboardBackend *backend = NULL;
+  const char *replay_path = GetEnvironmentPath("NATIVE_KEYMAP_REPLAY");
+  const char *fixture_path = GetEnvironmentPath("NATIVE_KEYMAP_FIXTURE");
+  if (replay_path) {
+    const char *speed = getenv("NATIVE_KEYMAP_REPLAY_SPEED");
+    backend = vscode_keyboard::LoadReplayKeyboardBackend(replay_path, stream, !(speed && strcmp(speed, "max") == 0));
+  } else if (fixture_path) {
+    backend = vscode_keyboard::LoadFakeKeyboardBackend(fixture_path);
+  } else if (Display *display = connect()) {
+    backend = vscode_keyboard::CreateXlibKeyboardBackend(display);
+  }
 
-    key_event->keycode = native_keycode;
-    {
-      key_event->state = mask_provider->XStateFromKeyMod(0);
-      std::string value = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "value", value.c_str()));
+  const char *record_path = GetEnvironmentPath("NATIVE_KEYMAP_RECORD");
+  if (backend && record_path) {
+    backend = vscode_keyboard::CreateRecordingKeyboardBackend(backend, record_path, stream);
+  }
+  return backend;
+}
+
+// Keeps the keymaps of the most recently active layouts and groups, so that
+// switching back to one of them does not evaluate any keysyms. All of them are
+// dropped when keys are remapped, e.g. by xmodmap.
+class LayoutKeyMapCache {
+ public:
+  static LayoutKeyMapCache& GetInstance() {
+    static LayoutKeyMapCache instance;
+    return instance;
+  }
+
+  // Identifies the keymaps computed since the last `Clear`.
+  uint64_t generation() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+  }
+
+  bool Find(uint64_t fingerprint, KeyMap *dst) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->fingerprint == fingerprint) {
+        *dst = it->key_map;
+        entries_.splice(entries_.begin(), entries_, it);
+        return true;
+      }
     }
+    return false;
+  }
 
-    {
-      key_event->state = mask_provider->XStateFromKeyMod(kShiftKeyModifierMask);
-      std::string with_shift = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "withShift", with_shift.c_str()));
+  // Drops `key_map` if keys were remapped since `generation`, because it may be outdated.
+  void Store(uint64_t fingerprint, uint64_t generation, const KeyMap &key_map) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_) {
+      return;
+    }
+    entries_.remove_if([fingerprint](const Entry &entry) { return entry.fingerprint == fingerprint; });
+    entries_.push_front({fingerprint, key_map});
+    if (entries_.size() > kCapacity) {
+      entries_.pop_back();
     }
+  }
 
-    {
-      key_event->state = mask_provider->XStateFromKeyMod(kLevel3KeyModifierMask);
-      std::string with_alt_gr = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "withAltGr", with_alt_gr.c_str()));
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    ++generation_;
+  }
+
+ private:
+  typedef struct {
+    uint64_t fingerprint;
+    KeyMap key_map;
+  } Entry;
+
+  // Enough for a few layouts with all of their groups
+  static const size_t kCapacity = 8;
+
+  LayoutKeyMapCache() : generation_(0) {}
+
+  std::mutex mutex_;
+  uint64_t generation_;
+  // The most recently used first
+  std::list<Entry> entries_;
+
+  LayoutKeyMapCache(const LayoutKeyMapCache&) = delete;
+  LayoutKeyMapCache& operator=(const LayoutKeyMapCache&) = delete;
+};
+
+// A connection that is kept open for the query functions, together with the
+// modifier mapping cached for it. It is guarded by `mutex`, so only hold it
+// through a `ScopedSharedDisplay`.
+struct SharedDisplay {
+  std::mutex mutex;
+  KeyboardBackend *backend;
+  KeyModifierMaskToXModifierMask mask_provider;
+  DisplayConnector connector;
+  // Fetched at most once per keyboard
+  bool has_geometry;
+  bool geometry_valid;
+  KeyboardGeometry geometry;
+};
+
+SharedDisplay shared_display = {};
+
+class ScopedSharedDisplay {
+ public:
+  ScopedSharedDisplay() : lock_(shared_display.mutex) {
+    Open();
+    if (shared_display.backend) {
+      Sync();
+    }
+  }
+
+  // Catches up with the mapping changes the server reported so far, e.g. the
+  // ones caused by changing the keyboard on this display.
+  void Sync() {
+    // Reading the state is a round trip, so afterwards every mapping change the
+    // server reported before is in the event queue.
+    KeyboardState state;
+    if (shared_display.backend->GetState(&state)) {
+      shared_display.mask_provider.UpdateGroup(state.group);
     }
 
-    {
-      key_event->state = mask_provider->XStateFromKeyMod(kShiftKeyModifierMask | kLevel3KeyModifierMask);
-      std::string with_shift_alt_gr = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "withShiftAltGr", with_shift_alt_gr.c_str()));
+    DrainEvents();
+    shared_display.mask_provider.EnsureModifiers(shared_display.backend);
+  }
+
+  KeyboardBackend* backend() const {
+    return shared_display.backend;
+  }
+
+  KeyModifierMaskToXModifierMask* mask_provider() const {
+    return &shared_display.mask_provider;
+  }
+
+  // Returns NULL if the keyboard has no geometry.
+  const KeyboardGeometry* geometry() const {
+    if (!shared_display.has_geometry) {
+      shared_display.geometry_valid = shared_display.backend->GetGeometry(&shared_display.geometry);
+      shared_display.has_geometry = true;
     }
+    return (shared_display.geometry_valid ? &shared_display.geometry : NULL);
+  }
 
-    {
-      // level 5 is important for the Neo layout family
-      key_event->state = mask_provider->XStateFromKeyMod(kLevel5KeyModifierMask);
-      std::string with_level5 = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "withLevel5", with_level5.c_str()));
+ private:
+  void Open() {
+    if (shared_display.backend) {
+      return;
     }
 
-    {
-      // level3 + level5 is Level 6 in terms of the Neo layout family. (Shift + level5 has no special meaning.)
-      key_event->state = mask_provider->XStateFromKeyMod(kLevel3KeyModifierMask | kLevel5KeyModifierMask);
-      std::string with_level3_level5 = GetStrFromXEvent(&event);
-      NAPI_CALL(env, napi_set_named_property_string_utf8(env, entry, "withLevel3Level5", with_level3_level5.c_str()));
+    // Connecting releases the lock, so another caller that waited for the same
+    // attempt may have opened the backend meanwhile
+    KeyboardBackend *backend = OpenKeyboardBackend(kSharedBackendStream, [this] { return shared_display.connector.Connect(&lock_); });
+    if (!backend || shared_display.backend) {
+      delete backend;
+      return;
     }
 
-    NAPI_CALL(env, napi_set_named_property(env, result, code, entry));
+    backend->SelectEvents(false);
+    shared_display.backend = backend;
+    shared_display.mask_provider.InvalidateModifiers();
+    shared_display.has_geometry = false;
+  }
+
+  void DrainEvents() {
+    KeyboardEvent event;
+    while (shared_display.backend->WaitForEvent(0, &event)) {
+      if (event.type != KeyboardEvent::kMappingChanged) {
+        continue;
+      }
+      if (event.modifiers_changed) {
+        shared_display.mask_provider.InvalidateModifiers();
+      }
+      if (event.keyboard_changed) {
+        shared_display.has_geometry = false;
+      } else if (event.change != vscode_keyboard::kKeyMapUnchanged) {
+        LayoutKeyMapCache::GetInstance().Clear();
+      }
+    }
   }
 
-  XFlush(display);
-  XCloseDisplay(display);
+  std::unique_lock<std::mutex> lock_;
 
-  return result;
-}
+  ScopedSharedDisplay(const ScopedSharedDisplay&) = delete;
+  ScopedSharedDisplay& operator=(const ScopedSharedDisplay&) = delete;
+};
 
-napi_value GetCurrentKeyboardLayoutImpl(napi_env env, napi_callback_info info) {
+} // namespace
 
-  napi_value result;
-  NAPI_CALL(env, napi_get_null(env, &result));
 
-  Display *display;
-  if (!(display = XOpenDisplay(""))) {
-    return result;
-  }
+namespace vscode_keyboard {
 
-  // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#determining_keyboard_state
-  XkbStateRec xkb_state;
-  XkbGetState(display, XkbUseCoreKbd, &xkb_state);
-  int effective_group_index = xkb_state.group;
+#define DOM_CODE(usb, evdev, xkb, win, mac, code, id) {usb, xkb, code}
+#define DOM_CODE_DECLARATION const KeycodeMapEntry usb_keycode_map[] =
+#include "../deps/chromium/dom_code_data.inc"
+#undef DOM_CODE
+#undef DOM_CODE_DECLARATION
 
-  XkbRF_VarDefsRec vdr;
-  char *tmp = NULL;
-  int res = XkbRF_GetNamesProp(display, &tmp, &vdr);
-  if (res) {
-    NAPI_CALL(env, napi_create_object(env, &result));
+// The flags of the states reported by `getModifierState` and `onDidChangeModifierState`.
+// The effective group is stored above them.
+enum ModifierStateFlag {
+  kShiftModifierState = 1 << 0,
+  kControlModifierState = 1 << 1,
+  kAltModifierState = 1 << 2,
+  kMetaModifierState = 1 << 3,
+  kAltGraphModifierState = 1 << 4,
+  kLevel5ModifierState = 1 << 5,
+  kCapsLockModifierState = 1 << 6,
+  kNumLockModifierState = 1 << 7
+};
+const int kModifierStateGroupShift = 8;
 
-    NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "model", vdr.model ? vdr.model : ""));
-    NAPI_CALL(env, napi_set_named_property_int32(env, result, "group", effective_group_index));
-    NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "layout", vdr.layout ? vdr.layout : ""));
-    NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "variant", vdr.variant ? vdr.variant : ""));
-    NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "options", vdr.options ? vdr.options : ""));
-    NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "rules", tmp ? tmp : ""));
+// `mask_provider` must be initialized for the display the state was read from.
+uint32_t ComputeModifierState(KeyModifierMaskToXModifierMask *mask_provider, unsigned int mods, unsigned int locked_mods, int group) {
+  uint32_t state = 0;
+  if (mods & ShiftMask) {
+    state |= kShiftModifierState;
   }
-
-  XFlush(display);
-  XCloseDisplay(display);
-  return result;
+  if (mods & ControlMask) {
+    state |= kControlModifierState;
+  }
+  if (mods & mask_provider->alt_modifier()) {
+    state |= kAltModifierState;
+  }
+  if (mods & mask_provider->meta_modifier()) {
+    state |= kMetaModifierState;
+  }
+  if (mods & (mask_provider->level3_modifier() | mask_provider->mode_switch_modifier())) {
+    state |= kAltGraphModifierState;
+  }
+  if (mods & mask_provider->level5_modifier()) {
+    state |= kLevel5ModifierState;
+  }
+  if (locked_mods & LockMask) {
+    state |= kCapsLockModifierState;
+  }
+  if (locked_mods & mask_provider->num_lock_modifier()) {
+    state |= kNumLockModifierState;
+  }
+  return state | (static_cast<uint32_t>(group) << kModifierStateGroupShift);
 }
 
 typedef struct {
   int effective_group_index;
+  bool has_names;
+  std::string model;
   std::string layout;
   std::string variant;
+  std::string options;
+  std::string rules;
 } KbState;
 
 bool KbStatesEqual(KbState *a, KbState *b) {
@@ -290,118 +615,1710 @@ bool KbStatesEqual(KbState *a, KbState *b) {
   );
 }
 
-void ReadKbState(Display *display, KbState *dst) {
-  // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#determining_keyboard_state
+void ReadKbState(KeyboardBackend *backend, KbState *dst) {
   // Get effective group index
-  XkbStateRec xkb_state;
-  XkbGetState(display, XkbUseCoreKbd, &xkb_state);
-  dst->effective_group_index = xkb_state.group;
+  KeyboardState state;
+  dst->effective_group_index = (backend->GetState(&state) ? state.group : 0);
+
+  KeyboardNames names;
+  dst->has_names = backend->GetNames(&names);
+  dst->model = names.model;
+  dst->layout = names.layout;
+  dst->variant = names.variant;
+  dst->options = names.options;
+  dst->rules = names.rules;
+}
 
-  XkbRF_VarDefsRec vdr;
-  char *tmp = NULL;
-  int res = XkbRF_GetNamesProp(display, &tmp, &vdr);
-  if (res) {
-    dst->layout = (vdr.layout ? vdr.layout : "");
-    dst->variant = (vdr.variant ? vdr.variant : "");
-  } else {
-    dst->layout = "";
-    dst->variant = "";
+void ComputeKeyMapping(KeyboardBackend *backend, KeyModifierMaskToXModifierMask *mask_provider, KeyMapping *mapping) {
+  for (size_t level = 0; level < kLevelCount; ++level) {
+    unsigned int state = mask_provider->XStateFromKeyMod(kLevelModifiers[level]);
+    mapping->values[level] = GetStrFromKeySym(backend->LookupKeySym(mapping->native_keycode, state));
   }
 }
 
-static void FlushAndCloseDisplay(void *arg) {
-  Display *display = static_cast<Display*>(arg);
-  XFlush(display);
-  XCloseDisplay(display);
+// Fills `dst` with an entry with empty values for every code that has a keycode.
+void InitKeyMapCodes(KeyMap *dst) {
+  size_t cnt = sizeof(usb_keycode_map) / sizeof(usb_keycode_map[0]);
+
+  dst->clear();
+  dst->reserve(cnt);
+
+  for (size_t i = 0; i < cnt; ++i) {
+    const char *code = usb_keycode_map[i].code;
+    int native_keycode = usb_keycode_map[i].native_keycode;
+
+    if (!code || native_keycode <= 0) {
+      continue;
+    }
+
+    KeyMapping mapping;
+    mapping.code = code;
+    mapping.native_keycode = native_keycode;
+    dst->push_back(mapping);
+  }
 }
 
-void* ListenToXEvents(void *arg) {
-  NotificationCallbackData *data = static_cast<NotificationCallbackData*>(arg);
+// Maps xkb keycodes to the index of their entry in the keymaps built by `InitKeyMapCodes`.
+class KeycodeIndexTable {
+ public:
+  static const KeycodeIndexTable& GetInstance() {
+    static const KeycodeIndexTable instance;
+    return instance;
+  }
 
-  Display *display;
-  if (!(display = XOpenDisplay(""))) {
-    return NULL;
+  // Returns -1 for keycodes without an entry.
+  int Find(uint32_t native_keycode) const {
+    return (native_keycode < kTableSize ? indices_[native_keycode] : -1);
   }
 
-  pthread_cleanup_push(FlushAndCloseDisplay, display);
+  const KeyMap& codes() const { return codes_; }
 
-  int xkblib_major = XkbMajorVersion;
-  int xkblib_minor = XkbMinorVersion;
-  if (!XkbLibraryVersion(&xkblib_major, &xkblib_minor)) {
-    return NULL;
+  // The DOM code index of every entry of `codes()`
+  const std::vector<uint32_t>& code_indices() const { return code_indices_; }
+
+ private:
+  // X keycodes are in [8, 255]
+  static const uint32_t kTableSize = 256;
+
+  KeycodeIndexTable() {
+    std::fill(indices_, indices_ + kTableSize, -1);
+    InitKeyMapCodes(&codes_);
+    size_t entry = 0;
+    for (size_t i = 0; i < codes_.size(); ++i) {
+      uint32_t native_keycode = codes_[i].native_keycode;
+      if (native_keycode < kTableSize && indices_[native_keycode] == -1) {
+        indices_[native_keycode] = i;
+      }
+
+      // `usb_keycode_map` holds the entries of dom_code_data.inc in order
+      while (usb_keycode_map[entry].code != codes_[i].code) {
+        ++entry;
+      }
+      code_indices_.push_back(entry);
+    }
   }
 
-  int opcode = 0;
-  int xkb_base_event_code = 0;
-  int xkb_base_error_code = 0;
-  if (!XkbQueryExtension(display, &opcode, &xkb_base_event_code, &xkb_base_error_code, &xkblib_major, &xkblib_minor)) {
-    return NULL;
+  int16_t indices_[kTableSize];
+  KeyMap codes_;
+  std::vector<uint32_t> code_indices_;
+
+  KeycodeIndexTable(const KeycodeIndexTable&) = delete;
+  KeycodeIndexTable& operator=(const KeycodeIndexTable&) = delete;
+};
+
+// `mask_provider` must already be initialized for `backend`.
+void ComputeKeyMap(KeyboardBackend *backend, KeyModifierMaskToXModifierMask *mask_provider, KeyMap *dst) {
+  InitKeyMapCodes(dst);
+  for (KeyMapping &mapping : *dst) {
+    ComputeKeyMapping(backend, mask_provider, &mapping);
+  }
+}
+
+// Recomputes only the entries whose keycodes are in [first_keycode, first_keycode + keycode_count).
+void RecomputeKeyMapRange(KeyboardBackend *backend, KeyModifierMaskToXModifierMask *mask_provider, int first_keycode, int keycode_count, KeyMap *key_map) {
+  for (KeyMapping &mapping : *key_map) {
+    if (mapping.native_keycode >= first_keycode && mapping.native_keycode < first_keycode + keycode_count) {
+      ComputeKeyMapping(backend, mask_provider, &mapping);
+    }
+  }
+}
+
+// The segments this process publishes its keymap into and reads keymaps published by another process from.
+// The mutex is never held while taking another lock.
+static std::mutex shared_key_map_mutex;
+static std::unique_ptr<SharedKeyMapSegment> published_key_map;
+static uint64_t published_key_map_epoch = 0;
+static std::string subscribed_key_map_name;
+static std::unique_ptr<SharedKeyMapSegment> subscribed_key_map;
+// The keymap last read from the subscribed segment
+static SharedKeyMapVersion subscribed_key_map_version = {0, 0};
+static KeyMap subscribed_key_map_value;
+
+// Keymaps may be published out of order, of which only the latest is kept.
+void PublishKeyMap(uint64_t epoch, const KeyMap &key_map) {
+  std::lock_guard<std::mutex> lock(shared_key_map_mutex);
+  if (published_key_map && epoch > published_key_map_epoch && published_key_map->Write(epoch, key_map)) {
+    published_key_map_epoch = epoch;
+  }
+}
+
+// Retains the most recently computed keymap and the one it replaced, so that
+// `getKeyMapDiff` can report only the entries that changed. The layout epoch is
+// advanced every time a computed keymap differs from the retained one.
+class KeyMapHistory {
+ public:
+  static KeyMapHistory& GetInstance() {
+    static KeyMapHistory instance;
+    return instance;
   }
 
-  // See https://www.x.org/releases/X11R7.6/doc/libX11/specs/XKB/xkblib.html#xkb_event_types
-  // Listen only to the `XkbStateNotify` event
-  XkbSelectEvents(display, XkbUseCoreKbd, XkbAllEventsMask, XkbStateNotifyMask);
+  // Returns true if `key_map` differs from the retained keymap, in which case
+  // `epoch`, if given, is set to the epoch it is retained at.
+  bool Record(const KeyMap &key_map, uint64_t *epoch = NULL) {
+    uint64_t recorded_epoch;
+    {
+      std::unique_lock<std::shared_mutex> lock(mutex_);
+      if (has_current_ && KeyMapsEqual(current_, key_map)) {
+        return false;
+      }
+      previous_.swap(current_);
+      previous_epoch_ = current_epoch_;
+      has_previous_ = has_current_;
+      current_ = key_map;
+      current_fingerprint_ = KeyMapFingerprint(current_);
+      current_epoch_ = recorded_epoch = AdvanceLayoutEpoch();
+      has_current_ = true;
+    }
+
+    PublishKeyMap(recorded_epoch, key_map);
+    if (epoch) {
+      *epoch = recorded_epoch;
+    }
+    return true;
+  }
 
-  KbState last_state;
-  ReadKbState(display, &last_state);
+  bool HasCurrent() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return has_current_;
+  }
 
-  XkbEvent event;
-  KbState current_state;
-  fd_set in_fds;
-  struct timeval tv;
-  int x11_fd = ConnectionNumber(display);
+  bool GetCurrent(KeyMap *dst, uint64_t *epoch = NULL) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (!has_current_) {
+      return false;
+    }
+    *dst = current_;
+    if (epoch) {
+      *epoch = current_epoch_;
+    }
+    return true;
+  }
 
-  while (true) {
-    // See https://stackoverflow.com/a/8592969 which explains
-    // the technique of waiting for an XEvent with a timeout
+  bool GetCurrentFingerprint(uint64_t *fingerprint) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (!has_current_) {
+      return false;
+    }
+    *fingerprint = current_fingerprint_;
+    return true;
+  }
 
-    // Create a File Description Set containing x11_fd
-    FD_ZERO(&in_fds);
-    FD_SET(x11_fd, &in_fds);
+  // Fills `base` with the keymap a client that last observed `since_epoch`
+  // is holding. Returns false when that keymap is no longer retained, in
+  // which case the client has to start over from the full keymap.
+  bool GetDiffBase(uint64_t since_epoch, KeyMap *base, KeyMap *current, uint64_t *epoch) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    *epoch = GetLayoutEpoch();
+    *current = current_;
+    if (!has_current_ || since_epoch == 0 || since_epoch > *epoch) {
+      return false;
+    }
+    if (since_epoch >= current_epoch_) {
+      *base = current_;
+      return true;
+    }
+    if (has_previous_ && since_epoch >= previous_epoch_) {
+      *base = previous_;
+      return true;
+    }
+    return false;
+  }
 
-    // Set the timer to 1s.
-    tv.tv_usec = 0;
-    tv.tv_sec = 1;
+ private:
+  KeyMapHistory() : current_epoch_(0), previous_epoch_(0), current_fingerprint_(0), has_current_(false), has_previous_(false) {}
+
+  // Shared by the listener thread and the readers on every env
+  std::shared_mutex mutex_;
+  uint64_t current_epoch_;
+  uint64_t previous_epoch_;
+  uint64_t current_fingerprint_;
+  bool has_current_;
+  bool has_previous_;
+  KeyMap current_;
+  KeyMap previous_;
+
+  KeyMapHistory(const KeyMapHistory&) = delete;
+  KeyMapHistory& operator=(const KeyMapHistory&) = delete;
+};
 
-    // Wait for X Event or the timer
-    select(x11_fd + 1, &in_fds, NULL, NULL, &tv);
+// The number of running listeners. While there is one, it keeps the retained
+// keymap and the published layout up to date.
+static std::atomic<int> active_listener_count(0);
+
+// Every env that listens to layout changes. They share a single listener
+// thread, which notifies all of them.
+static std::mutex listener_targets_mutex;
+static std::vector<NotificationCallbackData*> listener_targets;
+
+// The modifier state last seen by the listener, or -1 while there is no listener
+static std::atomic<int64_t> listened_modifier_state(-1);
+// Orders the modifier states delivered to every env. Guarded by `listener_targets_mutex`.
+static uint32_t modifier_state_sequence = 0;
+
+static void NotifyModifierState(uint32_t state) {
+  listened_modifier_state = state;
+  std::lock_guard<std::mutex> lock(listener_targets_mutex);
+  ++modifier_state_sequence;
+  for (NotificationCallbackData *data : listener_targets) {
+    CallModifierStateCallback(data, modifier_state_sequence, state);
+  }
+}
 
-    // Handle pending XEvents
-    while (XPending(display)) {
+// `epoch` must already have been advanced for the change, e.g. by `KeyMapHistory::Record`.
+static void NotifyListeners(uint64_t epoch) {
+  // Holding the lock also keeps each env's queue to a single producer
+  std::lock_guard<std::mutex> lock(listener_targets_mutex);
+  for (NotificationCallbackData *data : listener_targets) {
+    CallNotificationCallback(data, epoch);
+  }
+}
 
-      XNextEvent(display, &event.core);
+// The directory of the on-disk keymap cache. Empty if the cache is disabled.
+static std::mutex key_map_cache_mutex;
+static std::string key_map_cache_directory;
 
-      if (event.type == xkb_base_event_code && event.any.xkb_type == XkbStateNotify) {
-        ReadKbState(display, &current_state);
-        // printf("current state: %d | %s | %s\n", current_state.effective_group_index, current_state.layout.c_str(), current_state.variant.c_str());
-        if (!KbStatesEqual(&last_state, &current_state)) {
-          last_state.effective_group_index = current_state.effective_group_index;
-          last_state.layout = current_state.layout;
-          last_state.variant = current_state.variant;
+std::string GetKeyMapCacheDirectory() {
+  std::lock_guard<std::mutex> lock(key_map_cache_mutex);
+  return key_map_cache_directory;
+}
 
-          InvokeNotificationCallback(data);
-        }
-      }
+// Identifies the keymap files of a layout by its rules, model, layout, variant, options and group.
+uint64_t GetLayoutFingerprint(const KbState &state) {
+  uint64_t hash = kHashSeed;
+  hash = HashString(state.rules, hash);
+  hash = HashString(state.model, hash);
+  hash = HashString(state.layout, hash);
+  hash = HashString(state.variant, hash);
+  hash = HashString(state.options, hash);
+  hash = HashBytes(&state.effective_group_index, sizeof(state.effective_group_index), hash);
+  return hash;
+}
+
+void StoreLayoutKeyMap(const KbState &state, uint64_t generation, const KeyMap &key_map) {
+  if (state.has_names) {
+    LayoutKeyMapCache::GetInstance().Store(GetLayoutFingerprint(state), generation, key_map);
+  }
+}
+
+// Looks up the keymap of a layout in memory and then on disk, without evaluating any keysyms.
+bool FindLayoutKeyMap(const KbState &state, uint64_t generation, KeyMap *dst) {
+  if (!state.has_names) {
+    return false;
+  }
+
+  uint64_t fingerprint = GetLayoutFingerprint(state);
+  if (LayoutKeyMapCache::GetInstance().Find(fingerprint, dst)) {
+    return true;
+  }
+
+  std::string cache_directory = GetKeyMapCacheDirectory();
+  InitKeyMapCodes(dst);
+  if (cache_directory.empty() || !ReadKeyMapCacheFile(cache_directory, fingerprint, dst)) {
+    return false;
+  }
+  StoreLayoutKeyMap(state, generation, *dst);
+  return true;
+}
+
+// Computes the keymap on the shared display and retains it. A keymap that
+// differs from the retained one is also written to the disk cache, if enabled.
+bool ComputeCurrentKeyMap(KeyMap *dst) {
+  std::string cache_directory = GetKeyMapCacheDirectory();
+  uint64_t generation = LayoutKeyMapCache::GetInstance().generation();
+  KbState state;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return false;
     }
+
+    ReadKbState(display.backend(), &state);
+    display.mask_provider()->UpdateGroup(state.effective_group_index);
+    ComputeKeyMap(display.backend(), display.mask_provider(), dst);
   }
 
-  pthread_cleanup_pop(1);
+  StoreLayoutKeyMap(state, generation, *dst);
+  if (KeyMapHistory::GetInstance().Record(*dst) && state.has_names && !cache_directory.empty()) {
+    WriteKeyMapCacheFile(cache_directory, GetLayoutFingerprint(state), *dst);
+  }
+  return true;
+}
 
-  return NULL;
+// Reads the keymap that was cached on disk for the current layout, without evaluating any keysyms.
+bool ReadCachedKeyMap(KeyMap *dst) {
+  std::string cache_directory = GetKeyMapCacheDirectory();
+  if (cache_directory.empty()) {
+    return false;
+  }
+
+  KbState state;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return false;
+    }
+
+    ReadKbState(display.backend(), &state);
+  }
+
+  if (!state.has_names) {
+    return false;
+  }
+
+  InitKeyMapCodes(dst);
+  return ReadKeyMapCacheFile(cache_directory, GetLayoutFingerprint(state), dst);
 }
 
-void RegisterKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data) {
-  pthread_create(&data->tid, NULL, &ListenToXEvents, data);
+typedef struct {
+  napi_async_work work;
+  // The keymap that was handed out before the real one was known
+  KeyMap served_key_map;
+  bool differs;
+} KeyMapValidation;
+
+static std::atomic<bool> key_map_validation_pending(false);
+
+static void ExecuteKeyMapValidation(napi_env env, void *raw_data) {
+  KeyMapValidation *validation = static_cast<KeyMapValidation*>(raw_data);
+  KeyMap key_map;
+  validation->differs = ComputeCurrentKeyMap(&key_map) && !KeyMapsEqual(key_map, validation->served_key_map);
 }
 
-void DisposeKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data) {
-  pthread_cancel(data->tid);
-  void *res;
-  pthread_join(data->tid, &res);
+static void CompleteKeyMapValidation(napi_env env, napi_status status, void *raw_data) {
+  KeyMapValidation *validation = static_cast<KeyMapValidation*>(raw_data);
+  key_map_validation_pending = false;
+
+  // Retaining the differing keymap has advanced the epoch
+  if (status == napi_ok && validation->differs) {
+    NotifyListeners(GetLayoutEpoch());
+  }
+
+  napi_delete_async_work(env, validation->work);
+  delete validation;
 }
 
-napi_value IsISOKeyboardImpl(napi_env env, napi_callback_info info) {
-  return napi_fetch_undefined(env);
+// Computes the real keymap on the thread pool. Registered listeners are
+// notified if it differs from `served_key_map`.
+napi_status QueueKeyMapValidation(napi_env env, const KeyMap &served_key_map) {
+  if (key_map_validation_pending.exchange(true)) {
+    return napi_ok;
+  }
+
+  KeyMapValidation *validation = new KeyMapValidation();
+  validation->served_key_map = served_key_map;
+
+  napi_value resource_name;
+  NAPI_CALL_RETURN_STATUS(env, napi_create_string_utf8(env, "validateKeyMap", NAPI_AUTO_LENGTH, &resource_name));
+  NAPI_CALL_RETURN_STATUS(env, napi_create_async_work(env, NULL, resource_name, ExecuteKeyMapValidation,
+                                                      CompleteKeyMapValidation, validation, &validation->work));
+  NAPI_CALL_RETURN_STATUS(env, napi_queue_async_work(env, validation->work));
+  return napi_ok;
+}
+
+// Reads the keymap another process published, if this process subscribed to
+// one and its publisher is still running.
+bool ReadSubscribedKeyMap(KeyMap *dst) {
+  {
+    std::lock_guard<std::mutex> lock(shared_key_map_mutex);
+    if (!subscribed_key_map) {
+      return false;
+    }
+
+    // A publisher that exited has unlinked its segment, so a new one publishes into another
+    if (!subscribed_key_map->IsPublisherAlive()) {
+      std::unique_ptr<SharedKeyMapSegment> segment(SharedKeyMapSegment::OpenForReading(subscribed_key_map_name));
+      if (!segment || !segment->IsPublisherAlive()) {
+        return false;
+      }
+      subscribed_key_map.swap(segment);
+    }
+
+    SharedKeyMapVersion version;
+    if (!subscribed_key_map->ReadVersion(&version)) {
+      return false;
+    }
+    if (version == subscribed_key_map_version) {
+      *dst = subscribed_key_map_value;
+    } else {
+      InitKeyMapCodes(dst);
+      if (!subscribed_key_map->Read(dst, &version)) {
+        return false;
+      }
+      subscribed_key_map_version = version;
+      subscribed_key_map_value = *dst;
+    }
+  }
+
+  // Another keymap may have been retained since, e.g. by `setKeyboardGroup`
+  KeyMapHistory::GetInstance().Record(*dst);
+  return true;
+}
+
+bool ReadKeyMap(napi_env env, KeyMap *dst) {
+  KeyMapHistory &history = KeyMapHistory::GetInstance();
+  if (active_listener_count > 0 && history.GetCurrent(dst)) {
+    return true;
+  }
+
+  if (ReadSubscribedKeyMap(dst)) {
+    return true;
+  }
+
+  // At startup, serve the keymap cached on disk and validate it in the background
+  if (!history.HasCurrent() && ReadCachedKeyMap(dst)) {
+    history.Record(*dst);
+    QueueKeyMapValidation(env, *dst);
+    return true;
+  }
+
+  if (ComputeCurrentKeyMap(dst)) {
+    return true;
+  }
+
+  // Fall back to the last keymap that could be computed
+  return history.GetCurrent(dst);
+}
+
+napi_value GetKeyMapImpl(napi_env env, napi_callback_info info) {
+  KeyMap key_map;
+  ReadKeyMap(env, &key_map);
+
+  napi_value result;
+  NAPI_CALL(env, CreateKeyMapObject(env, key_map, &result));
+  return result;
+}
+
+typedef struct {
+  const char *code;
+  const char *values[kLevelCount];
+} DefaultKeyMapping;
+
+// A canonical US keymap, served by `getKeyMapFast` until the real keymap is known.
+constexpr DefaultKeyMapping kDefaultKeyMap[] = {
+#define DEFAULT_KEY_MAPPING(code, value, with_shift, with_alt_gr, with_shift_alt_gr, with_level5, with_level3_level5) \
+  {code, {value, with_shift, with_alt_gr, with_shift_alt_gr, with_level5, with_level3_level5}},
+#include "default_keymap_data.inc"
+#undef DEFAULT_KEY_MAPPING
+};
+
+// Expands `kDefaultKeyMap` to the same codes `ComputeKeyMap` produces.
+const KeyMap& GetDefaultKeyMap() {
+  static const KeyMap key_map = [] {
+    KeyMap result;
+    InitKeyMapCodes(&result);
+    for (KeyMapping &mapping : result) {
+      for (const DefaultKeyMapping &default_mapping : kDefaultKeyMap) {
+        if (strcmp(default_mapping.code, mapping.code) == 0) {
+          for (size_t level = 0; level < kLevelCount; ++level) {
+            mapping.values[level] = default_mapping.values[level];
+          }
+          break;
+        }
+      }
+    }
+    return result;
+  }();
+  return key_map;
+}
+
+napi_value GetKeyMapFingerprintImpl(napi_env env, napi_callback_info info) {
+  KeyMapHistory &history = KeyMapHistory::GetInstance();
+  uint64_t fingerprint;
+  if (active_listener_count == 0 || !history.GetCurrentFingerprint(&fingerprint)) {
+    KeyMap key_map;
+    if (!ReadKeyMap(env, &key_map)) {
+      return napi_fetch_null(env);
+    }
+    fingerprint = KeyMapFingerprint(key_map);
+  }
+
+  char value[17];
+  snprintf(value, sizeof(value), "%016llx", static_cast<unsigned long long>(fingerprint));
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_string_utf8(env, value, NAPI_AUTO_LENGTH, &result));
+  return result;
+}
+
+napi_value GetKeyMapFastImpl(napi_env env, napi_callback_info info) {
+  KeyMap key_map;
+  if (!KeyMapHistory::GetInstance().GetCurrent(&key_map)) {
+    key_map = GetDefaultKeyMap();
+    NAPI_CALL(env, QueueKeyMapValidation(env, key_map));
+  }
+
+  napi_value result;
+  NAPI_CALL(env, CreateKeyMapObject(env, key_map, &result));
+  return result;
+}
+
+napi_value GetKeyMapDiffImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_number, "Wrong type of arguments. Expects a number as first argument.");
+
+  int64_t since_epoch;
+  NAPI_CALL(env, napi_get_value_int64(env, args[0], &since_epoch));
+
+  // Retaining the keymap that is served is a no-op unless it was read without
+  // being retained, so the diff ends at it or at one retained meanwhile.
+  KeyMapHistory &history = KeyMapHistory::GetInstance();
+  KeyMap key_map;
+  if (ReadKeyMap(env, &key_map)) {
+    history.Record(key_map);
+  }
+
+  KeyMap base;
+  KeyMap current;
+  uint64_t epoch;
+  bool has_base = history.GetDiffBase(since_epoch > 0 ? since_epoch : 0, &base, &current, &epoch);
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+
+  napi_value epoch_value;
+  NAPI_CALL(env, napi_create_int64(env, epoch, &epoch_value));
+  NAPI_CALL(env, napi_set_named_property(env, result, "epoch", epoch_value));
+
+  // A client whose keymap is not retained anymore has to replace it rather than merge the entries
+  napi_value full;
+  NAPI_CALL(env, napi_get_boolean(env, !has_base, &full));
+  NAPI_CALL(env, napi_set_named_property(env, result, "full", full));
+
+  napi_value added;
+  NAPI_CALL(env, napi_create_object(env, &added));
+  napi_value changed;
+  NAPI_CALL(env, napi_create_object(env, &changed));
+  napi_value removed;
+  NAPI_CALL(env, napi_create_array(env, &removed));
+
+  // Without a base, every entry is reported as added.
+  for (const KeyMapping &mapping : current) {
+    const KeyMapping *old_mapping = (has_base ? FindKeyMapping(base, mapping.code) : NULL);
+    if (old_mapping && KeyMappingsEqual(*old_mapping, mapping)) {
+      continue;
+    }
+    napi_value entry;
+    NAPI_CALL(env, CreateKeyMappingObject(env, mapping, &entry));
+    NAPI_CALL(env, napi_set_named_property(env, old_mapping ? changed : added, mapping.code, entry));
+  }
+
+  uint32_t removed_count = 0;
+  for (const KeyMapping &mapping : base) {
+    if (!FindKeyMapping(current, mapping.code)) {
+      napi_value code;
+      NAPI_CALL(env, napi_create_string_utf8(env, mapping.code, NAPI_AUTO_LENGTH, &code));
+      NAPI_CALL(env, napi_set_element(env, removed, removed_count++, code));
+    }
+  }
+
+  NAPI_CALL(env, napi_set_named_property(env, result, "added", added));
+  NAPI_CALL(env, napi_set_named_property(env, result, "removed", removed));
+  NAPI_CALL(env, napi_set_named_property(env, result, "changed", changed));
+
+  return result;
+}
+
+// The layout last read by a running listener. It is only set while at least one
+// listener is active, because only then it is kept up to date.
+static std::shared_ptr<const KbState> listened_kb_state;
+
+static void PublishKbState(const KbState &state) {
+  std::atomic_store(&listened_kb_state, std::shared_ptr<const KbState>(new KbState(state)));
+}
+
+napi_value CreateKeyboardLayoutObject(napi_env env, const KbState &state) {
+  if (!state.has_names) {
+    return napi_fetch_null(env);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "model", state.model.c_str()));
+  NAPI_CALL(env, napi_set_named_property_int32(env, result, "group", state.effective_group_index));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "layout", state.layout.c_str()));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "variant", state.variant.c_str()));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "options", state.options.c_str()));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "rules", state.rules.c_str()));
+
+  return result;
+}
+
+napi_value GetCurrentKeyboardLayoutImpl(napi_env env, napi_callback_info info) {
+
+  // A running listener keeps the layout up to date, so no X round trip is needed
+  std::shared_ptr<const KbState> listened_state = std::atomic_load(&listened_kb_state);
+  if (listened_state) {
+    return CreateKeyboardLayoutObject(env, *listened_state);
+  }
+
+  KbState state;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return napi_fetch_null(env);
+    }
+
+    ReadKbState(display.backend(), &state);
+  }
+
+  return CreateKeyboardLayoutObject(env, state);
+}
+
+// Switches the group, having built its keymap beforehand, so that a running
+// listener finds the keymap in the cache when it is notified of the switch.
+static bool LockKeyboardGroup(int group) {
+  uint64_t generation = LayoutKeyMapCache::GetInstance().generation();
+  KeyMap key_map;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return false;
+    }
+
+    KbState state;
+    ReadKbState(display.backend(), &state);
+    state.effective_group_index = group;
+    if (!FindLayoutKeyMap(state, generation, &key_map)) {
+      display.mask_provider()->UpdateGroup(group);
+      ComputeKeyMap(display.backend(), display.mask_provider(), &key_map);
+      StoreLayoutKeyMap(state, generation, key_map);
+    }
+
+    if (!display.backend()->LockGroup(group)) {
+      return false;
+    }
+  }
+
+  KeyMapHistory::GetInstance().Record(key_map);
+  return true;
+}
+
+// Loads the layout and retains its keymap, which is taken from the cache if
+// the layout was active before.
+static bool LoadKeyboardLayout(const KeyboardNames &names) {
+  uint64_t generation = LayoutKeyMapCache::GetInstance().generation();
+  KeyMap key_map;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend() || !display.backend()->SetLayout(names)) {
+      return false;
+    }
+
+    // The new keyboard may bind the modifiers to other keys
+    display.Sync();
+    KbState state;
+    ReadKbState(display.backend(), &state);
+    if (!FindLayoutKeyMap(state, generation, &key_map)) {
+      display.mask_provider()->UpdateGroup(state.effective_group_index);
+      ComputeKeyMap(display.backend(), display.mask_provider(), &key_map);
+      StoreLayoutKeyMap(state, generation, key_map);
+    }
+  }
+
+  KeyMapHistory::GetInstance().Record(key_map);
+  return true;
+}
+
+napi_value SetKeyboardGroupImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_number, "Wrong type of arguments. Expects a number as first argument.");
+
+  int32_t group;
+  NAPI_CALL(env, napi_get_value_int32(env, args[0], &group));
+  NAPI_ASSERT(env, group >= 0 && group < XkbNumKbdGroups, "Wrong value of arguments. Expects a group between 0 and 3.");
+
+  return napi_fetch_boolean(env, LockKeyboardGroup(group));
+}
+
+napi_value SetKeyboardLayoutImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_object, "Wrong type of arguments. Expects an object as first argument.");
+
+  // The names that are not given keep their current values
+  KbState state;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return napi_fetch_boolean(env, false);
+    }
+    ReadKbState(display.backend(), &state);
+  }
+
+  KeyboardNames names;
+  names.rules = state.rules;
+  names.model = state.model;
+  names.layout = state.layout;
+  names.variant = state.variant;
+  names.options = state.options;
+  NAPI_CALL(env, napi_get_named_property_string_utf8(env, args[0], "rules", &names.rules));
+  NAPI_CALL(env, napi_get_named_property_string_utf8(env, args[0], "model", &names.model));
+  NAPI_CALL(env, napi_get_named_property_string_utf8(env, args[0], "layout", &names.layout));
+  NAPI_CALL(env, napi_get_named_property_string_utf8(env, args[0], "variant", &names.variant));
+  NAPI_CALL(env, napi_get_named_property_string_utf8(env, args[0], "options", &names.options));
+
+  return napi_fetch_boolean(env, LoadKeyboardLayout(names));
+}
+
+static void EndListening() {
+  if (--active_listener_count == 0) {
+    std::atomic_store(&listened_kb_state, std::shared_ptr<const KbState>());
+    listened_modifier_state = -1;
+  }
+}
+
+// Set to stop the listener thread, which checks it at least once a second. The
+// thread is not cancelled, because it may hold locks of Node or of stdio.
+static std::atomic<bool> listener_thread_stopping(false);
+
+void* ListenToXEvents(void *arg) {
+  // The listener has a backend of its own, because the shared one must not be held while waiting for events
+  KeyboardBackend *backend;
+  if (!(backend = OpenKeyboardBackend(kListenerBackendStream, [] { return XOpenDisplay(""); }))) {
+    return NULL;
+  }
+
+  // Listen to state changes for layout and group switches and to mapping changes
+  if (backend->SelectEvents(true)) {
+    KbState last_state;
+    ReadKbState(backend, &last_state);
+
+    KeyModifierMaskToXModifierMask mask_provider;
+    mask_provider.Initialize(backend);
+    uint64_t initial_generation = LayoutKeyMapCache::GetInstance().generation();
+    KeyMap key_map;
+    ComputeKeyMap(backend, &mask_provider, &key_map);
+    StoreLayoutKeyMap(last_state, initial_generation, key_map);
+    KeyMapHistory::GetInstance().Record(key_map);
+
+    ++active_listener_count;
+    PublishKbState(last_state);
+
+    uint32_t last_modifier_state = 0;
+    KeyboardState keyboard_state;
+    if (backend->GetState(&keyboard_state)) {
+      last_modifier_state = ComputeModifierState(&mask_provider, keyboard_state.mods, keyboard_state.locked_mods, keyboard_state.group);
+    }
+    listened_modifier_state = last_modifier_state;
+
+    KeyboardEvent event;
+    KbState current_state;
+    LayoutKeyMapCache &layout_key_maps = LayoutKeyMapCache::GetInstance();
+
+    while (!listener_thread_stopping) {
+      if (!backend->WaitForEvent(1000, &event)) {
+        continue;
+      }
+
+      KeyMapChange change = kKeyMapUnchanged;
+      // Whether the keymap of the new layout may be taken from the cache
+      bool layout_switched = false;
+
+      if (event.type == KeyboardEvent::kStateChanged) {
+        mask_provider.EnsureModifiers(backend);
+        uint32_t modifier_state = ComputeModifierState(&mask_provider, event.state.mods, event.state.locked_mods, event.state.group);
+        if (modifier_state != last_modifier_state) {
+          last_modifier_state = modifier_state;
+          NotifyModifierState(modifier_state);
+        }
+
+        // Most state changes are modifier presses, which need no round trip for the names
+        if (event.state.group != last_state.effective_group_index) {
+          mask_provider.UpdateGroup(event.state.group);
+          ReadKbState(backend, &current_state);
+          bool changed = !KbStatesEqual(&last_state, &current_state);
+          last_state = current_state;
+          PublishKbState(last_state);
+
+          if (changed) {
+            change = kKeyMapFullyChanged;
+            layout_switched = true;
+          }
+        }
+      } else {
+        if (event.modifiers_changed) {
+          mask_provider.InvalidateModifiers();
+        }
+        change = event.change;
+
+        // A new keyboard comes with new names, while remapped keys outdate every cached keymap
+        if (event.keyboard_changed) {
+          ReadKbState(backend, &last_state);
+          mask_provider.UpdateGroup(last_state.effective_group_index);
+          PublishKbState(last_state);
+          layout_switched = true;
+        } else if (change != kKeyMapUnchanged) {
+          layout_key_maps.Clear();
+        }
+      }
+
+      if (change == kKeyMapUnchanged) {
+        continue;
+      }
+
+      uint64_t generation = layout_key_maps.generation();
+      if (change == kKeyMapFullyChanged) {
+        mask_provider.EnsureModifiers(backend);
+        if (!(layout_switched && last_state.has_names && layout_key_maps.Find(GetLayoutFingerprint(last_state), &key_map))) {
+          ComputeKeyMap(backend, &mask_provider, &key_map);
+        }
+      } else {
+        RecomputeKeyMapRange(backend, &mask_provider, event.first_keycode, event.keycode_count, &key_map);
+      }
+      StoreLayoutKeyMap(last_state, generation, key_map);
+
+      // Retaining a differing keymap advances the epoch, a layout switch that
+      // types the same as before is still a change of its own
+      if (KeyMapHistory::GetInstance().Record(key_map)) {
+        NotifyListeners(GetLayoutEpoch());
+      } else if (event.type == KeyboardEvent::kStateChanged) {
+        NotifyListeners(AdvanceLayoutEpoch());
+      }
+    }
+
+    EndListening();
+  }
+
+  delete backend;
+  return NULL;
+}
+
+// Guards the lifetime of the listener thread. It is never held while notifying,
+// so that the listener thread can be joined under it.
+static std::mutex listener_thread_mutex;
+static pthread_t listener_thread;
+static bool listener_thread_running = false;
+
+void RegisterKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data) {
+  std::lock_guard<std::mutex> lock(listener_thread_mutex);
+  {
+    std::lock_guard<std::mutex> targets_lock(listener_targets_mutex);
+    if (std::find(listener_targets.begin(), listener_targets.end(), data) == listener_targets.end()) {
+      listener_targets.push_back(data);
+    }
+  }
+
+  if (!listener_thread_running) {
+    listener_thread_stopping = false;
+    listener_thread_running = (pthread_create(&listener_thread, NULL, &ListenToXEvents, NULL) == 0);
+  }
+}
+
+void DisposeKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data) {
+  std::lock_guard<std::mutex> lock(listener_thread_mutex);
+  bool has_targets;
+  {
+    std::lock_guard<std::mutex> targets_lock(listener_targets_mutex);
+    listener_targets.erase(std::remove(listener_targets.begin(), listener_targets.end(), data), listener_targets.end());
+    has_targets = !listener_targets.empty();
+  }
+
+  // The last env to stop listening stops the thread, which takes up to a second
+  if (!has_targets && listener_thread_running) {
+    listener_thread_stopping = true;
+    void *res;
+    pthread_join(listener_thread, &res);
+    listener_thread_running = false;
+  }
+}
+
+// The listener thread serves modifier state listeners too
+void RegisterModifierStateListenerImpl(NotificationCallbackData *data) {
+  RegisterKeyboardLayoutChangeListenerImpl(data);
+}
+
+void DisposeModifierStateListenerImpl(NotificationCallbackData *data) {
+  DisposeKeyboardLayoutChangeListenerImpl(data);
+}
+
+napi_value GetModifierStateImpl(napi_env env, napi_callback_info info) {
+  int64_t state = listened_modifier_state;
+  if (state < 0) {
+    ScopedSharedDisplay display;
+    KeyboardState keyboard_state;
+    if (!display.backend() || !display.backend()->GetState(&keyboard_state)) {
+      return napi_fetch_null(env);
+    }
+    state = ComputeModifierState(display.mask_provider(), keyboard_state.mods, keyboard_state.locked_mods, keyboard_state.group);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_uint32(env, static_cast<uint32_t>(state), &result));
+  return result;
+}
+
+// Physical keyboard types reported by `getKeyboardType`
+enum KeyboardType {
+  kUnknownKeyboardType,
+  kAnsiKeyboardType,
+  kIsoKeyboardType,
+  kJisKeyboardType,
+  kAbntKeyboardType
+};
+
+const char* const kKeyboardTypeNames[] = {NULL, "ANSI", "ISO", "JIS", "ABNT"};
+
+// Returns 0 if no key has `code`.
+static unsigned int GetNativeKeycode(const char *code) {
+  for (const KeyMapping &mapping : KeycodeIndexTable::GetInstance().codes()) {
+    if (strcmp(mapping.code, code) == 0) {
+      return mapping.native_keycode;
+    }
+  }
+  return 0;
+}
+
+// Returns the keysym the key of `code` produces without modifiers.
+static KeySym GetKeySym(const ScopedSharedDisplay &display, const char *code) {
+  unsigned int keycode = GetNativeKeycode(code);
+  if (!keycode) {
+    return NoSymbol;
+  }
+  return display.backend()->LookupKeySym(keycode, display.mask_provider()->XStateFromKeyMod(0));
+}
+
+static bool EndsWith(const std::string &value, const char *suffix) {
+  size_t length = strlen(suffix);
+  return (value.size() >= length && value.compare(value.size() - length, length, suffix) == 0);
+}
+
+// X has no notion of the physical keyboard, so the type is derived from the
+// configured model and from the keys the keymap binds: <AB11> (IntlRo) only
+// exists on JIS and ABNT keyboards and <AE13> (IntlYen) only on JIS keyboards.
+//
+// <LSGT> (IntlBackslash) only exists on ISO keyboards, but the `pc` symbols bind
+// it for every layout and pc105 is the default model of most distributions, so
+// neither of them tells an ISO keyboard from an ANSI one. ISO is only reported
+// if the model names it, if the layout binds <LSGT> to something of its own or
+// if the geometry of a specific model has the key.
+static KeyboardType DetectKeyboardType(const ScopedSharedDisplay &display, const KbState &state) {
+  const std::string &model = state.model;
+  if (model.compare(0, 2, "jp") == 0) {
+    return kJisKeyboardType;
+  }
+  if (model.compare(0, 4, "abnt") == 0) {
+    return kAbntKeyboardType;
+  }
+
+  KeySym lsgt = GetKeySym(display, "IntlBackslash");
+  if (GetKeySym(display, "IntlRo") != NoSymbol) {
+    return (lsgt != NoSymbol && GetKeySym(display, "IntlYen") == NoSymbol ? kAbntKeyboardType : kJisKeyboardType);
+  }
+  if (model.compare(0, 5, "pc101") == 0 || model.compare(0, 5, "pc104") == 0 || EndsWith(model, "_ansi")) {
+    return kAnsiKeyboardType;
+  }
+  if (model.compare(0, 5, "pc102") == 0 || EndsWith(model, "_iso")) {
+    return kIsoKeyboardType;
+  }
+  if (lsgt == NoSymbol) {
+    return kAnsiKeyboardType;
+  }
+  // The `pc` symbols produce less and greater
+  if (lsgt != XK_less) {
+    return kIsoKeyboardType;
+  }
+
+  // The geometry of generic models follows from the model name as well
+  bool is_generic_model = (model.empty() || (model.compare(0, 2, "pc") == 0 && model.size() > 2 && isdigit(model[2])));
+  const KeyboardGeometry *geometry = (is_generic_model ? NULL : display.geometry());
+  if (!geometry) {
+    return kUnknownKeyboardType;
+  }
+  unsigned int keycode = GetNativeKeycode("IntlBackslash");
+  for (const KeyGeometry &key : geometry->keys) {
+    if (key.keycode == keycode) {
+      return kIsoKeyboardType;
+    }
+  }
+  return kAnsiKeyboardType;
+}
+
+// The keyboard type is detected at most once per layout epoch
+static std::mutex keyboard_type_mutex;
+static bool has_keyboard_type = false;
+static uint64_t keyboard_type_epoch = 0;
+static KeyboardType keyboard_type = kUnknownKeyboardType;
+
+static KeyboardType GetKeyboardType() {
+  uint64_t epoch = GetLayoutEpoch();
+  {
+    std::lock_guard<std::mutex> lock(keyboard_type_mutex);
+    if (has_keyboard_type && keyboard_type_epoch == epoch) {
+      return keyboard_type;
+    }
+  }
+
+  KeyboardType type;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return kUnknownKeyboardType;
+    }
+
+    KbState state;
+    ReadKbState(display.backend(), &state);
+    display.mask_provider()->UpdateGroup(state.effective_group_index);
+    type = DetectKeyboardType(display, state);
+  }
+
+  std::lock_guard<std::mutex> lock(keyboard_type_mutex);
+  has_keyboard_type = true;
+  keyboard_type_epoch = epoch;
+  keyboard_type = type;
+  return type;
+}
+
+napi_value IsISOKeyboardImpl(napi_env env, napi_callback_info info) {
+  // ABNT keyboards are ISO keyboards with an additional key
+  KeyboardType type = GetKeyboardType();
+  if (type == kUnknownKeyboardType) {
+    return napi_fetch_undefined(env);
+  }
+  return napi_fetch_boolean(env, type == kIsoKeyboardType || type == kAbntKeyboardType);
+}
+
+napi_value GetKeyboardTypeImpl(napi_env env, napi_callback_info info) {
+  KeyboardType type = GetKeyboardType();
+  if (type == kUnknownKeyboardType) {
+    return napi_fetch_undefined(env);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_string_utf8(env, kKeyboardTypeNames[type], NAPI_AUTO_LENGTH, &result));
+  return result;
+}
+
+napi_value SetConnectionOptionsImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_object, "Wrong type of arguments. Expects an object as first argument.");
+
+  int timeout_ms = -1;
+  int max_backoff_ms = -1;
+  NAPI_CALL(env, napi_get_named_property_int32(env, args[0], "timeout", &timeout_ms));
+  NAPI_CALL(env, napi_get_named_property_int32(env, args[0], "maxBackoff", &max_backoff_ms));
+
+  std::lock_guard<std::mutex> lock(shared_display.mutex);
+  shared_display.connector.Configure(timeout_ms, max_backoff_ms);
+
+  return napi_fetch_undefined(env);
+}
+
+napi_value SetKeyMapCacheDirectoryImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_string || valuetype0 == napi_null, "Wrong type of arguments. Expects a string or null as first argument.");
+
+  std::string directory;
+  if (valuetype0 == napi_string) {
+    size_t length;
+    NAPI_CALL(env, napi_get_value_string_utf8(env, args[0], NULL, 0, &length));
+    directory.resize(length + 1);
+    NAPI_CALL(env, napi_get_value_string_utf8(env, args[0], &directory[0], directory.size(), &length));
+    directory.resize(length);
+  }
+
+  std::lock_guard<std::mutex> lock(key_map_cache_mutex);
+  key_map_cache_directory = directory;
+
+  return napi_fetch_undefined(env);
+}
+
+static bool GetSegmentNameArgument(napi_env env, napi_callback_info info, std::string *name) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL_BASE(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL), false);
+
+  NAPI_ASSERT_BASE(env, argc == 1, "Wrong number of arguments. Expects a single argument.", false);
+
+  napi_valuetype valuetype0;
+  NAPI_CALL_BASE(env, napi_typeof(env, args[0], &valuetype0), false);
+  NAPI_ASSERT_BASE(env, valuetype0 == napi_string, "Wrong type of arguments. Expects a string as first argument.", false);
+
+  size_t length;
+  NAPI_CALL_BASE(env, napi_get_value_string_utf8(env, args[0], NULL, 0, &length), false);
+  name->resize(length + 1);
+  NAPI_CALL_BASE(env, napi_get_value_string_utf8(env, args[0], &(*name)[0], name->size(), &length), false);
+  name->resize(length);
+  return true;
+}
+
+napi_value PublishSharedKeyMapImpl(napi_env env, napi_callback_info info) {
+  std::string name;
+  if (!GetSegmentNameArgument(env, info, &name)) {
+    return NULL;
+  }
+
+  SharedKeyMapSegment *segment = SharedKeyMapSegment::OpenForPublishing(name);
+  if (!segment) {
+    return napi_fetch_boolean(env, false);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared_key_map_mutex);
+    published_key_map.reset(segment);
+    published_key_map_epoch = 0;
+  }
+
+  // Keymaps retained from now on are published by `Record`, so this one is skipped if it is outdated already
+  KeyMap key_map;
+  uint64_t epoch;
+  if (KeyMapHistory::GetInstance().GetCurrent(&key_map, &epoch)) {
+    PublishKeyMap(epoch, key_map);
+  }
+  return napi_fetch_boolean(env, true);
+}
+
+napi_value SubscribeSharedKeyMapImpl(napi_env env, napi_callback_info info) {
+  std::string name;
+  if (!GetSegmentNameArgument(env, info, &name)) {
+    return NULL;
+  }
+
+  SharedKeyMapSegment *segment = SharedKeyMapSegment::OpenForReading(name);
+  if (!segment) {
+    return napi_fetch_boolean(env, false);
+  }
+
+  std::lock_guard<std::mutex> lock(shared_key_map_mutex);
+  subscribed_key_map_name = name;
+  subscribed_key_map.reset(segment);
+  subscribed_key_map_version = {0, 0};
+  subscribed_key_map_value.clear();
+  return napi_fetch_boolean(env, true);
+}
+
+napi_value SerializeKeyMapImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  bool delta = false;
+  if (argc >= 1) {
+    napi_valuetype valuetype0;
+    NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+    NAPI_ASSERT(env, valuetype0 == napi_boolean || valuetype0 == napi_undefined, "Wrong type of arguments. Expects a boolean as first argument.");
+    if (valuetype0 == napi_boolean) {
+      NAPI_CALL(env, napi_get_value_bool(env, args[0], &delta));
+    }
+  }
+
+  KeyMap key_map;
+  ReadKeyMap(env, &key_map);
+
+  std::string data;
+  SerializeKeyMap(key_map, delta ? &GetDefaultKeyMap() : NULL, &data);
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_buffer_copy(env, data.size(), data.data(), NULL, &result));
+  return result;
+}
+
+napi_value DeserializeKeyMapImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  bool is_typedarray;
+  NAPI_CALL(env, napi_is_typedarray(env, args[0], &is_typedarray));
+  NAPI_ASSERT(env, is_typedarray, "Wrong type of arguments. Expects a Uint8Array as first argument.");
+
+  napi_typedarray_type type;
+  size_t length;
+  void *data;
+  NAPI_CALL(env, napi_get_typedarray_info(env, args[0], &type, &length, &data, NULL, NULL));
+  NAPI_ASSERT(env, type == napi_uint8_array, "Wrong type of arguments. Expects a Uint8Array as first argument.");
+
+  KeyMap key_map;
+  InitKeyMapCodes(&key_map);
+  if (!DeserializeKeyMap(static_cast<const unsigned char*>(data), length, GetDefaultKeyMap(), &key_map)) {
+    return napi_fetch_null(env);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, CreateKeyMapObject(env, key_map, &result));
+  return result;
+}
+
+// Returns the level of `kLevelNames` that `key_mod` selects, or -1.
+static int FindLevel(uint32_t key_mod) {
+  for (size_t level = 0; level < kLevelCount; ++level) {
+    if (static_cast<uint32_t>(kLevelModifiers[level]) == key_mod) {
+      return level;
+    }
+  }
+  return -1;
+}
+
+static napi_status CreateCodeArray(napi_env env, const KeyMap &key_map, napi_value *result) {
+  NAPI_CALL_RETURN_STATUS(env, napi_create_array_with_length(env, key_map.size(), result));
+  for (size_t i = 0; i < key_map.size(); ++i) {
+    napi_value code;
+    NAPI_CALL_RETURN_STATUS(env, napi_create_string_utf8(env, key_map[i].code, NAPI_AUTO_LENGTH, &code));
+    NAPI_CALL_RETURN_STATUS(env, napi_set_element(env, *result, i, code));
+  }
+  return napi_ok;
+}
+
+napi_value TranslateKeysImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value args[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 2, "Wrong number of arguments. Expects two arguments.");
+
+  uint32_t *keycodes;
+  size_t count;
+  NAPI_ASSERT(env, napi_get_value_uint32_array(env, args[0], &keycodes, &count) == napi_ok, "Wrong type of arguments. Expects a Uint32Array as first argument.");
+  uint32_t *states;
+  size_t state_count;
+  NAPI_ASSERT(env, napi_get_value_uint32_array(env, args[1], &states, &state_count) == napi_ok, "Wrong type of arguments. Expects a Uint32Array as second argument.");
+  NAPI_ASSERT(env, count == state_count, "Wrong arguments. Expects as many states as keycodes.");
+
+  const KeycodeIndexTable &table = KeycodeIndexTable::GetInstance();
+
+  // Keys pressed with the modifiers of a level are answered from the keymap,
+  // all others are looked up on the display.
+  KeyMap key_map;
+  bool has_key_map = (ReadKeyMap(env, &key_map) && key_map.size() == table.codes().size());
+
+  napi_value code_indices_array;
+  int32_t *code_indices;
+  NAPI_CALL(env, napi_create_int32_array(env, count, &code_indices, &code_indices_array));
+  napi_value characters_array;
+  uint32_t *characters;
+  NAPI_CALL(env, napi_create_uint32_array(env, count, &characters, &characters_array));
+
+  std::unique_ptr<ScopedSharedDisplay> display;
+  for (size_t i = 0; i < count; ++i) {
+    int index = table.Find(keycodes[i]);
+    int level = FindLevel(states[i]);
+    code_indices[i] = index;
+    characters[i] = 0;
+
+    if (has_key_map && index >= 0 && level >= 0) {
+      characters[i] = DecodeCharacter(key_map[index].values[level]);
+      continue;
+    }
+
+    if (!display) {
+      display.reset(new ScopedSharedDisplay());
+    }
+    if (display->backend()) {
+      unsigned int state = display->mask_provider()->XStateFromKeyMod(states[i]);
+      characters[i] = ui::GetUnicodeCharacterFromXKeySym(display->backend()->LookupKeySym(keycodes[i], state));
+    }
+  }
+
+  napi_value codes;
+  NAPI_CALL(env, CreateCodeArray(env, table.codes(), &codes));
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_set_named_property(env, result, "codes", codes));
+  NAPI_CALL(env, napi_set_named_property(env, result, "codeIndices", code_indices_array));
+  NAPI_CALL(env, napi_set_named_property(env, result, "characters", characters_array));
+  return result;
+}
+
+napi_value GetKeyClassesImpl(napi_env env, napi_callback_info info) {
+  const KeyMap &codes = KeycodeIndexTable::GetInstance().codes();
+
+  napi_value classes_array;
+  uint32_t *classes;
+  {
+    ScopedSharedDisplay display;
+    if (!display.backend()) {
+      return napi_fetch_null(env);
+    }
+
+    NAPI_CALL(env, napi_create_uint32_array(env, codes.size(), &classes, &classes_array));
+
+    for (size_t i = 0; i < codes.size(); ++i) {
+      classes[i] = 0;
+      for (size_t level = 0; level < kLevelCount; ++level) {
+        unsigned int state = display.mask_provider()->XStateFromKeyMod(kLevelModifiers[level]);
+        classes[i] |= ClassifyKeySym(display.backend()->LookupKeySym(codes[i].native_keycode, state)) << (level * kKeyClassBits);
+      }
+    }
+  }
+
+  napi_value codes_array;
+  NAPI_CALL(env, CreateCodeArray(env, codes, &codes_array));
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_set_named_property(env, result, "codes", codes_array));
+  NAPI_CALL(env, napi_set_named_property(env, result, "classes", classes_array));
+  return result;
+}
+
+napi_value GetKeyboardGeometryImpl(napi_env env, napi_callback_info info) {
+  const KeycodeIndexTable &table = KeycodeIndexTable::GetInstance();
+  int width, height;
+  std::vector<const KeyMapping*> mappings;
+  std::vector<int32_t> rects;
+  {
+    ScopedSharedDisplay display;
+    const KeyboardGeometry *geometry = (display.backend() ? display.geometry() : NULL);
+    if (!geometry) {
+      return napi_fetch_null(env);
+    }
+
+    width = geometry->width;
+    height = geometry->height;
+    for (const KeyGeometry &key : geometry->keys) {
+      int index = table.Find(key.keycode);
+      if (index < 0) {
+        continue;
+      }
+      mappings.push_back(&table.codes()[index]);
+      rects.insert(rects.end(), {key.x, key.y, key.width, key.height});
+    }
+  }
+
+  napi_value codes;
+  NAPI_CALL(env, napi_create_array_with_length(env, mappings.size(), &codes));
+  for (size_t i = 0; i < mappings.size(); ++i) {
+    napi_value code;
+    NAPI_CALL(env, napi_create_string_utf8(env, mappings[i]->code, NAPI_AUTO_LENGTH, &code));
+    NAPI_CALL(env, napi_set_element(env, codes, i, code));
+  }
+
+  napi_value rects_array;
+  int32_t *rects_data;
+  NAPI_CALL(env, napi_create_int32_array(env, rects.size(), &rects_data, &rects_array));
+  std::copy(rects.begin(), rects.end(), rects_data);
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_set_named_property_int32(env, result, "width", width));
+  NAPI_CALL(env, napi_set_named_property_int32(env, result, "height", height));
+  NAPI_CALL(env, napi_set_named_property(env, result, "codes", codes));
+  NAPI_CALL(env, napi_set_named_property(env, result, "rects", rects_array));
+  return result;
+}
+
+// Each env has its own keybindings, which are only used on its JS thread
+static napi_status GetKeybindingResolver(napi_env env, KeybindingResolver **result) {
+  NotificationCallbackData *data;
+  napi_status status = napi_get_instance_data(env, (void**)&data);
+  if (status != napi_ok) {
+    return status;
+  }
+  if (!data->keybinding_resolver) {
+    data->keybinding_resolver = new KeybindingResolver();
+  }
+  *result = data->keybinding_resolver;
+  return napi_ok;
+}
+
+napi_value SetKeybindingsImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  uint32_t *words;
+  size_t count;
+  NAPI_ASSERT(env, napi_get_value_uint32_array(env, args[0], &words, &count) == napi_ok, "Wrong type of arguments. Expects a Uint32Array as first argument.");
+  NAPI_ASSERT(env, count % KeybindingResolver::kWordsPerBinding == 0, "Wrong arguments. Expects four words per keybinding.");
+
+  KeybindingResolver *keybinding_resolver;
+  NAPI_CALL(env, GetKeybindingResolver(env, &keybinding_resolver));
+  keybinding_resolver->SetBindings(words, count);
+
+  return napi_fetch_undefined(env);
+}
+
+napi_value ResolveKeybindingsImpl(napi_env env, napi_callback_info info) {
+  KeybindingResolver *keybinding_resolver;
+  NAPI_CALL(env, GetKeybindingResolver(env, &keybinding_resolver));
+
+  const KeycodeIndexTable &table = KeycodeIndexTable::GetInstance();
+  KeyMap key_map;
+  if (!ReadKeyMap(env, &key_map) || key_map.size() != table.codes().size()) {
+    return napi_fetch_null(env);
+  }
+
+  std::vector<uint32_t> changed;
+  keybinding_resolver->Resolve(key_map, table.code_indices(), &changed);
+
+  napi_value indices_array;
+  uint32_t *indices;
+  NAPI_CALL(env, napi_create_uint32_array(env, changed.size(), &indices, &indices_array));
+  napi_value chords_array;
+  uint32_t *chords;
+  NAPI_CALL(env, napi_create_uint32_array(env, changed.size() * KeybindingResolver::kWordsPerBinding, &chords, &chords_array));
+  napi_value flags_array;
+  uint32_t *flags;
+  NAPI_CALL(env, napi_create_uint32_array(env, changed.size(), &flags, &flags_array));
+  napi_value conflicts_array;
+  int32_t *conflicts;
+  NAPI_CALL(env, napi_create_int32_array(env, changed.size(), &conflicts, &conflicts_array));
+  napi_value labels;
+  NAPI_CALL(env, napi_create_array_with_length(env, changed.size(), &labels));
+
+  for (size_t i = 0; i < changed.size(); ++i) {
+    const KeybindingResolver::Resolution &resolution = keybinding_resolver->resolution(changed[i]);
+    indices[i] = changed[i];
+    std::copy(resolution.chords, resolution.chords + KeybindingResolver::kWordsPerBinding, chords + i * KeybindingResolver::kWordsPerBinding);
+    flags[i] = resolution.flags;
+    conflicts[i] = resolution.conflict;
+
+    napi_value label;
+    NAPI_CALL(env, napi_create_string_utf8(env, resolution.label.c_str(), resolution.label.size(), &label));
+    NAPI_CALL(env, napi_set_element(env, labels, i, label));
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_set_named_property(env, result, "indices", indices_array));
+  NAPI_CALL(env, napi_set_named_property(env, result, "labels", labels));
+  NAPI_CALL(env, napi_set_named_property(env, result, "chords", chords_array));
+  NAPI_CALL(env, napi_set_named_property(env, result, "flags", flags_array));
+  NAPI_CALL(env, napi_set_named_property(env, result, "conflicts", conflicts_array));
+  return result;
+}
+
+napi_value IdentifyLayoutImpl(napi_env env, napi_callback_info info) {
+  KeyMap key_map;
+  if (!ReadKeyMap(env, &key_map)) {
+    return napi_fetch_null(env);
+  }
+
+  LayoutSignature signature;
+  ComputeLayoutSignature(key_map, &signature);
+  LayoutMatch match;
+  FindNearestLayout(signature, &match);
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "layout", match.layout));
+  NAPI_CALL(env, napi_set_named_property_string_utf8(env, result, "variant", match.variant));
+  NAPI_CALL(env, napi_set_named_property_int32(env, result, "distance", match.distance));
+  return result;
+}
+
+// Checking the Compose files stats each of them, so lookups do it at most this often
+const std::chrono::milliseconds kComposeTableCheckIntervalMs(2000);
+
+static std::mutex compose_table_mutex;
+static bool has_compose_table = false;
+static std::chrono::steady_clock::time_point compose_table_checked;
+static std::shared_ptr<ComposeTable> compose_table;
+
+// Reloads the table when a Compose file has changed. Returns NULL if there is no Compose file.
+static std::shared_ptr<ComposeTable> GetComposeTable() {
+  std::lock_guard<std::mutex> lock(compose_table_mutex);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (has_compose_table && now - compose_table_checked < kComposeTableCheckIntervalMs) {
+    return compose_table;
+  }
+
+  if (!has_compose_table || !compose_table || compose_table->IsOutdated()) {
+    compose_table.reset(ComposeTable::Load(GetKeyMapCacheDirectory()));
+    has_compose_table = true;
+  }
+  compose_table_checked = now;
+  return compose_table;
+}
+
+static std::string GetKeySymName(uint32_t keysym) {
+  // XKeysymToString allocates the names of Unicode keysyms
+  char name[16];
+  if ((keysym & 0xff000000) == 0x01000000) {
+    snprintf(name, sizeof(name), "U%04X", keysym & 0x00ffffff);
+    return name;
+  }
+  const char *result = XKeysymToString(keysym);
+  if (!result) {
+    snprintf(name, sizeof(name), "0x%08x", keysym);
+    return name;
+  }
+  return result;
+}
+
+napi_value GetComposeResultImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  bool is_array;
+  NAPI_CALL(env, napi_is_array(env, args[0], &is_array));
+  NAPI_ASSERT(env, is_array, "Wrong type of arguments. Expects an array of keysym names as first argument.");
+
+  uint32_t length;
+  NAPI_CALL(env, napi_get_array_length(env, args[0], &length));
+  std::vector<uint32_t> keysyms;
+  for (uint32_t i = 0; i < length; ++i) {
+    napi_value element;
+    NAPI_CALL(env, napi_get_element(env, args[0], i, &element));
+    napi_valuetype valuetype;
+    NAPI_CALL(env, napi_typeof(env, element, &valuetype));
+    NAPI_ASSERT(env, valuetype == napi_string, "Wrong type of arguments. Expects an array of keysym names as first argument.");
+
+    size_t name_length;
+    NAPI_CALL(env, napi_get_value_string_utf8(env, element, NULL, 0, &name_length));
+    std::string name(name_length + 1, '\0');
+    NAPI_CALL(env, napi_get_value_string_utf8(env, element, &name[0], name.size(), &name_length));
+    name.resize(name_length);
+    KeySym keysym = XStringToKeysym(name.c_str());
+    if (keysym == NoSymbol) {
+      return napi_fetch_null(env);
+    }
+    keysyms.push_back(static_cast<uint32_t>(keysym));
+  }
+
+  std::shared_ptr<ComposeTable> table = GetComposeTable();
+  std::string value;
+  if (!table || !table->Lookup(keysyms, &value)) {
+    return napi_fetch_null(env);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_string_utf8(env, value.c_str(), value.size(), &result));
+  return result;
+}
+
+napi_value FindComposeSequencesImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_string, "Wrong type of arguments. Expects a string as first argument.");
+
+  size_t length;
+  NAPI_CALL(env, napi_get_value_string_utf8(env, args[0], NULL, 0, &length));
+  std::string text(length + 1, '\0');
+  NAPI_CALL(env, napi_get_value_string_utf8(env, args[0], &text[0], text.size(), &length));
+  text.resize(length);
+
+  std::vector<std::vector<uint32_t>> sequences;
+  std::shared_ptr<ComposeTable> table = GetComposeTable();
+  if (table) {
+    table->FindSequences(text, &sequences);
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_array_with_length(env, sequences.size(), &result));
+  for (size_t i = 0; i < sequences.size(); ++i) {
+    napi_value sequence;
+    NAPI_CALL(env, napi_create_array_with_length(env, sequences[i].size(), &sequence));
+    for (size_t j = 0; j < sequences[i].size(); ++j) {
+      std::string name = GetKeySymName(sequences[i][j]);
+      napi_value keysym;
+      NAPI_CALL(env, napi_create_string_utf8(env, name.c_str(), name.size(), &keysym));
+      NAPI_CALL(env, napi_set_element(env, sequence, j, keysym));
+    }
+    NAPI_CALL(env, napi_set_element(env, result, i, sequence));
+  }
+  return result;
+}
+
+napi_value GetKeyboardSnapshotImpl(napi_env env, napi_callback_info info) {
+  bool has_display = false;
+  KbState state;
+  KeyMap key_map;
+  KeyboardType type = kUnknownKeyboardType;
+  uint64_t epoch = GetLayoutEpoch();
+  int modifier_masks[6] = {};
+  {
+    ScopedSharedDisplay display;
+    if (display.backend()) {
+      has_display = true;
+
+      // Compute the keymap for exactly the group that was read together with
+      // the layout names, so that the layout and the keymap always match.
+      ReadKbState(display.backend(), &state);
+      KeyModifierMaskToXModifierMask *mask_provider = display.mask_provider();
+      mask_provider->UpdateGroup(state.effective_group_index);
+      ComputeKeyMap(display.backend(), mask_provider, &key_map);
+      type = DetectKeyboardType(display, state);
+      epoch = GetLayoutEpoch();
+
+      modifier_masks[0] = mask_provider->alt_modifier();
+      modifier_masks[1] = mask_provider->meta_modifier();
+      modifier_masks[2] = mask_provider->num_lock_modifier();
+      modifier_masks[3] = mask_provider->mode_switch_modifier();
+      modifier_masks[4] = mask_provider->level3_modifier();
+      modifier_masks[5] = mask_provider->level5_modifier();
+    }
+  }
+
+  // Retaining a keymap that differs from the previous one advances the epoch
+  if (has_display) {
+    KeyMapHistory::GetInstance().Record(key_map, &epoch);
+  }
+
+  napi_value layout = (has_display ? CreateKeyboardLayoutObject(env, state) : napi_fetch_null(env));
+  if (layout == NULL) {
+    return NULL;
+  }
+
+  napi_value key_map_value;
+  NAPI_CALL(env, CreateKeyMapObject(env, key_map, &key_map_value));
+
+  // ABNT keyboards are ISO keyboards with an additional key
+  napi_value is_iso_keyboard = (type == kUnknownKeyboardType ? napi_fetch_undefined(env)
+                                : napi_fetch_boolean(env, type == kIsoKeyboardType || type == kAbntKeyboardType));
+
+  napi_value result;
+  NAPI_CALL(env, CreateKeyboardSnapshotObject(env, epoch, layout, key_map_value, is_iso_keyboard, &result));
+
+  napi_value modifiers;
+  NAPI_CALL(env, napi_create_object(env, &modifiers));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "alt", modifier_masks[0]));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "meta", modifier_masks[1]));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "numLock", modifier_masks[2]));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "modeSwitch", modifier_masks[3]));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "level3", modifier_masks[4]));
+  NAPI_CALL(env, napi_set_named_property_int32(env, modifiers, "level5", modifier_masks[5]));
+  NAPI_CALL(env, napi_set_named_property(env, result, "modifiers", modifiers));
+
+  return result;
 }
 
 } // namespace vscode_keyboard
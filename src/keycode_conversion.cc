@@ -0,0 +1,191 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "keymapping.h"
+#include "common.h"
+
+namespace vscode_keyboard {
+
+namespace {
+
+typedef struct {
+  uint32_t usb;
+  uint32_t evdev;
+  uint32_t xkb;
+  const char *code;
+} DomCodeEntry;
+
+#define DOM_CODE(usb, evdev, xkb, win, mac, code, id) {usb, evdev, xkb, code}
+#define DOM_CODE_DECLARATION constexpr DomCodeEntry kDomCodes[] =
+#include "../deps/chromium/dom_code_data.inc"
+#undef DOM_CODE
+#undef DOM_CODE_DECLARATION
+
+constexpr size_t kDomCodeCount = sizeof(kDomCodes) / sizeof(kDomCodes[0]);
+
+// Entry 0 is the invalid code, so index 0 doubles as "no mapping" in every table.
+static_assert(kDomCodes[0].usb == 0 && kDomCodes[0].evdev == 0 && kDomCodes[0].code == nullptr, "Unexpected first entry in dom_code_data.inc");
+
+// USB keycodes are spread over a few usage pages, each of which gets a dense table.
+constexpr uint32_t kUsbPages[] = {0x00, 0x01, 0x07, 0x0c};
+constexpr size_t kUsbPageCount = sizeof(kUsbPages) / sizeof(kUsbPages[0]);
+constexpr uint32_t kUsbUsagesPerPage = 0x300;
+constexpr uint32_t kScancodeCount = 0x300;
+
+enum class KeycodeKind {
+  Usb,
+  Evdev,
+  Xkb,
+  Code
+};
+
+constexpr int FindUsbPageSlot(uint32_t usb) {
+  for (size_t slot = 0; slot < kUsbPageCount; ++slot) {
+    if (kUsbPages[slot] == (usb >> 16)) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+// Returns the position of `value` in the dense table of `kind`, or -1.
+constexpr int GetSlot(KeycodeKind kind, uint32_t value) {
+  if (kind == KeycodeKind::Usb) {
+    int page_slot = FindUsbPageSlot(value);
+    if (page_slot < 0 || (value & 0xffff) >= kUsbUsagesPerPage) {
+      return -1;
+    }
+    return page_slot * kUsbUsagesPerPage + (value & 0xffff);
+  }
+  return (value < kScancodeCount ? static_cast<int>(value) : -1);
+}
+
+constexpr uint32_t GetKeycode(const DomCodeEntry &entry, KeycodeKind kind) {
+  return (kind == KeycodeKind::Usb ? entry.usb : kind == KeycodeKind::Evdev ? entry.evdev : entry.xkb);
+}
+
+constexpr bool AllKeycodesFit() {
+  for (size_t i = 1; i < kDomCodeCount; ++i) {
+    if (GetSlot(KeycodeKind::Usb, kDomCodes[i].usb) < 0 || kDomCodes[i].evdev >= kScancodeCount || kDomCodes[i].xkb >= kScancodeCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(kDomCodeCount <= UINT16_MAX, "Too many entries in dom_code_data.inc");
+static_assert(AllKeycodesFit(), "A keycode in dom_code_data.inc does not fit the lookup tables");
+
+// Maps keycodes of one kind to their index in `kDomCodes`.
+template <size_t N>
+struct DomCodeIndexTable {
+  uint16_t indices[N];
+};
+
+template <size_t N>
+constexpr DomCodeIndexTable<N> BuildIndexTable(KeycodeKind kind) {
+  DomCodeIndexTable<N> table = {};
+  for (size_t i = 1; i < kDomCodeCount; ++i) {
+    uint32_t keycode = GetKeycode(kDomCodes[i], kind);
+    // Several codes share the keycode 0, which means they have none
+    if (keycode != 0 && table.indices[GetSlot(kind, keycode)] == 0) {
+      table.indices[GetSlot(kind, keycode)] = i;
+    }
+  }
+  return table;
+}
+
+constexpr DomCodeIndexTable<kUsbPageCount * kUsbUsagesPerPage> kUsbIndices = BuildIndexTable<kUsbPageCount * kUsbUsagesPerPage>(KeycodeKind::Usb);
+constexpr DomCodeIndexTable<kScancodeCount> kEvdevIndices = BuildIndexTable<kScancodeCount>(KeycodeKind::Evdev);
+constexpr DomCodeIndexTable<kScancodeCount> kXkbIndices = BuildIndexTable<kScancodeCount>(KeycodeKind::Xkb);
+
+uint32_t FindDomCodeIndex(KeycodeKind kind, uint32_t value) {
+  if (kind == KeycodeKind::Code) {
+    return (value < kDomCodeCount ? value : 0);
+  }
+  int slot = GetSlot(kind, value);
+  if (slot < 0) {
+    return 0;
+  }
+  switch (kind) {
+    case KeycodeKind::Usb:
+      return kUsbIndices.indices[slot];
+    case KeycodeKind::Evdev:
+      return kEvdevIndices.indices[slot];
+    default:
+      return kXkbIndices.indices[slot];
+  }
+}
+
+bool GetKeycodeKindArgument(napi_env env, napi_value value, KeycodeKind *kind) {
+  napi_valuetype valuetype;
+  NAPI_CALL_BASE(env, napi_typeof(env, value, &valuetype), false);
+  if (valuetype != napi_string) {
+    return false;
+  }
+
+  char name[8];
+  size_t length;
+  NAPI_CALL_BASE(env, napi_get_value_string_utf8(env, value, name, sizeof(name), &length), false);
+  if (strcmp(name, "usb") == 0) {
+    *kind = KeycodeKind::Usb;
+  } else if (strcmp(name, "evdev") == 0) {
+    *kind = KeycodeKind::Evdev;
+  } else if (strcmp(name, "xkb") == 0) {
+    *kind = KeycodeKind::Xkb;
+  } else if (strcmp(name, "code") == 0) {
+    *kind = KeycodeKind::Code;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+napi_value GetDomCodesImpl(napi_env env, napi_callback_info info) {
+  napi_value result;
+  NAPI_CALL(env, napi_create_array_with_length(env, kDomCodeCount, &result));
+  for (size_t i = 0; i < kDomCodeCount; ++i) {
+    napi_value code;
+    if (kDomCodes[i].code) {
+      NAPI_CALL(env, napi_create_string_utf8(env, kDomCodes[i].code, NAPI_AUTO_LENGTH, &code));
+    } else {
+      NAPI_CALL(env, napi_get_null(env, &code));
+    }
+    NAPI_CALL(env, napi_set_element(env, result, i, code));
+  }
+  return result;
+}
+
+napi_value ConvertKeycodesImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value args[3];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 3, "Wrong number of arguments. Expects three arguments.");
+
+  uint32_t *values;
+  size_t count;
+  NAPI_ASSERT(env, napi_get_value_uint32_array(env, args[0], &values, &count) == napi_ok, "Wrong type of arguments. Expects a Uint32Array as first argument.");
+  KeycodeKind from;
+  NAPI_ASSERT(env, GetKeycodeKindArgument(env, args[1], &from), "Wrong type of arguments. Expects 'usb', 'evdev', 'xkb' or 'code' as second argument.");
+  KeycodeKind to;
+  NAPI_ASSERT(env, GetKeycodeKindArgument(env, args[2], &to), "Wrong type of arguments. Expects 'usb', 'evdev', 'xkb' or 'code' as third argument.");
+
+  napi_value result;
+  uint32_t *converted;
+  NAPI_CALL(env, napi_create_uint32_array(env, count, &converted, &result));
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t index = FindDomCodeIndex(from, values[i]);
+    converted[i] = (to == KeycodeKind::Code ? index : GetKeycode(kDomCodes[index], to));
+  }
+  return result;
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,142 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keymap.h"
+#include "keymapping.h"
+#include "common.h"
+
+#include <string.h>
+
+namespace vscode_keyboard {
+
+const char* const kLevelNames[kLevelCount] = {
+  "value",
+  "withShift",
+  "withAltGr",
+  "withShiftAltGr",
+  // level 5 is important for the Neo layout family
+  "withLevel5",
+  // level3 + level5 is Level 6 in terms of the Neo layout family. (Shift + level5 has no special meaning.)
+  "withLevel3Level5"
+};
+
+const int kLevelModifiers[kLevelCount] = {
+  0,
+  kShiftKeyModifierMask,
+  kLevel3KeyModifierMask,
+  kShiftKeyModifierMask | kLevel3KeyModifierMask,
+  kLevel5KeyModifierMask,
+  kLevel3KeyModifierMask | kLevel5KeyModifierMask
+};
+
+bool KeyMappingsEqual(const KeyMapping &a, const KeyMapping &b) {
+  for (size_t level = 0; level < kLevelCount; ++level) {
+    if (a.values[level] != b.values[level]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool KeyMapsEqual(const KeyMap &a, const KeyMap &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].code != b[i].code || !KeyMappingsEqual(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const KeyMapping* FindKeyMapping(const KeyMap &key_map, const char *code) {
+  for (const KeyMapping &mapping : key_map) {
+    if (strcmp(mapping.code, code) == 0) {
+      return &mapping;
+    }
+  }
+  return NULL;
+}
+
+uint32_t DecodeCharacter(const std::string &value) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(value.c_str());
+  if (bytes[0] < 0x80) {
+    return bytes[0];
+  }
+  if ((bytes[0] & 0xe0) == 0xc0 && bytes[1]) {
+    return ((bytes[0] & 0x1f) << 6) | (bytes[1] & 0x3f);
+  }
+  if ((bytes[0] & 0xf0) == 0xe0 && bytes[1] && bytes[2]) {
+    return ((bytes[0] & 0x0f) << 12) | ((bytes[1] & 0x3f) << 6) | (bytes[2] & 0x3f);
+  }
+  if ((bytes[0] & 0xf8) == 0xf0 && bytes[1] && bytes[2] && bytes[3]) {
+    return ((bytes[0] & 0x07) << 18) | ((bytes[1] & 0x3f) << 12) | ((bytes[2] & 0x3f) << 6) | (bytes[3] & 0x3f);
+  }
+  return 0;
+}
+
+void AppendCharacter(uint32_t character, std::string *dst) {
+  if (character < 0x80) {
+    dst->push_back(character);
+  } else if (character < 0x800) {
+    dst->push_back(0xc0 | (character >> 6));
+    dst->push_back(0x80 | (character & 0x3f));
+  } else if (character < 0x10000) {
+    dst->push_back(0xe0 | (character >> 12));
+    dst->push_back(0x80 | ((character >> 6) & 0x3f));
+    dst->push_back(0x80 | (character & 0x3f));
+  } else {
+    dst->push_back(0xf0 | (character >> 18));
+    dst->push_back(0x80 | ((character >> 12) & 0x3f));
+    dst->push_back(0x80 | ((character >> 6) & 0x3f));
+    dst->push_back(0x80 | (character & 0x3f));
+  }
+}
+
+napi_status CreateKeyMappingObject(napi_env env, const KeyMapping &mapping, napi_value *result) {
+  NAPI_CALL_RETURN_STATUS(env, napi_create_object(env, result));
+  for (size_t level = 0; level < kLevelCount; ++level) {
+    NAPI_CALL_RETURN_STATUS(env, napi_set_named_property_string_utf8(env, *result, kLevelNames[level], mapping.values[level].c_str()));
+  }
+  return napi_ok;
+}
+
+napi_status CreateKeyMapObject(napi_env env, const KeyMap &key_map, napi_value *result) {
+  NAPI_CALL_RETURN_STATUS(env, napi_create_object(env, result));
+  for (const KeyMapping &mapping : key_map) {
+    napi_value entry;
+    NAPI_CALL_RETURN_STATUS(env, CreateKeyMappingObject(env, mapping, &entry));
+    NAPI_CALL_RETURN_STATUS(env, napi_set_named_property(env, *result, mapping.code, entry));
+  }
+  return napi_ok;
+}
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+uint64_t HashString(const std::string &str, uint64_t hash) {
+  // Include the terminating NUL so that adjacent strings cannot run into each other
+  return HashBytes(str.c_str(), str.size() + 1, hash);
+}
+
+uint64_t KeyMapFingerprint(const KeyMap &key_map) {
+  uint64_t hash = kHashSeed;
+  for (const KeyMapping &mapping : key_map) {
+    hash = HashBytes(mapping.code, strlen(mapping.code) + 1, hash);
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      hash = HashString(mapping.values[level], hash);
+    }
+  }
+  return hash;
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,56 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <node_api.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace vscode_keyboard {
+
+// The levels reported for every key, in the order in which they are stored in
+// `KeyMapping::values`.
+const size_t kLevelCount = 6;
+
+extern const char* const kLevelNames[kLevelCount];
+
+// The `KeyModifierMask` that selects each level
+extern const int kLevelModifiers[kLevelCount];
+
+typedef struct {
+  // Points into the static keycode mapping table
+  const char *code;
+  int native_keycode;
+  std::string values[kLevelCount];
+} KeyMapping;
+
+typedef std::vector<KeyMapping> KeyMap;
+
+bool KeyMappingsEqual(const KeyMapping &a, const KeyMapping &b);
+bool KeyMapsEqual(const KeyMap &a, const KeyMap &b);
+const KeyMapping* FindKeyMapping(const KeyMap &key_map, const char *code);
+
+// Values hold at most a single character. Returns 0 for an empty value.
+uint32_t DecodeCharacter(const std::string &value);
+void AppendCharacter(uint32_t character, std::string *dst);
+
+napi_status CreateKeyMappingObject(napi_env env, const KeyMapping &mapping, napi_value *result);
+napi_status CreateKeyMapObject(napi_env env, const KeyMap &key_map, napi_value *result);
+
+// 64-bit FNV-1a. Pass the result of a previous call as `hash` to continue hashing.
+const uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash);
+uint64_t HashString(const std::string &str, uint64_t hash);
+
+// Identifies the content of a keymap, independently of the layout it was computed for.
+uint64_t KeyMapFingerprint(const KeyMap &key_map);
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYMAP_H_
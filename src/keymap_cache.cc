@@ -0,0 +1,184 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keymap_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+
+namespace {
+
+const char kMagic[4] = {'N', 'K', 'M', 'C'};
+const uint32_t kVersion = 1;
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+  uint32_t entry_count;
+  uint32_t string_pool_size;
+} KeyMapCacheHeader;
+
+typedef struct {
+  // Offsets into the string pool
+  uint32_t code;
+  uint32_t values[vscode_keyboard::kLevelCount];
+} KeyMapCacheEntry;
+
+std::string GetCacheFileName(uint64_t fingerprint) {
+  char name[32];
+  snprintf(name, sizeof(name), "keymap-%016llx.bin", static_cast<unsigned long long>(fingerprint));
+  return name;
+}
+
+// Returns NULL if `offset` does not point to a NUL-terminated string inside the pool.
+const char* GetPoolString(const char *pool, uint32_t pool_size, uint32_t offset) {
+  if (offset >= pool_size || !memchr(pool + offset, '\0', pool_size - offset)) {
+    return NULL;
+  }
+  return pool + offset;
+}
+
+} // namespace
+
+namespace vscode_keyboard {
+
+bool UnpackKeyMap(const char *data, size_t size, uint64_t fingerprint, KeyMap *dst) {
+  if (size < sizeof(KeyMapCacheHeader)) {
+    return false;
+  }
+
+  const KeyMapCacheHeader *header = reinterpret_cast<const KeyMapCacheHeader*>(data);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion || header->fingerprint != fingerprint) {
+    return false;
+  }
+  if (header->entry_count != dst->size()) {
+    return false;
+  }
+
+  size_t entries_size = header->entry_count * sizeof(KeyMapCacheEntry);
+  if (size != sizeof(KeyMapCacheHeader) + entries_size + header->string_pool_size) {
+    return false;
+  }
+
+  const KeyMapCacheEntry *entries = reinterpret_cast<const KeyMapCacheEntry*>(data + sizeof(KeyMapCacheHeader));
+  const char *pool = data + sizeof(KeyMapCacheHeader) + entries_size;
+
+  for (size_t i = 0; i < dst->size(); ++i) {
+    KeyMapping &mapping = (*dst)[i];
+
+    const char *code = GetPoolString(pool, header->string_pool_size, entries[i].code);
+    if (!code || strcmp(code, mapping.code) != 0) {
+      return false;
+    }
+
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      const char *value = GetPoolString(pool, header->string_pool_size, entries[i].values[level]);
+      if (!value) {
+        return false;
+      }
+      mapping.values[level] = value;
+    }
+  }
+
+  return true;
+}
+
+void PackKeyMap(uint64_t fingerprint, const KeyMap &key_map, std::string *dst) {
+  // Identical strings are stored once. The pool starts with the empty string.
+  std::string pool(1, '\0');
+  std::map<std::string, uint32_t> pool_offsets;
+  pool_offsets[""] = 0;
+  auto intern = [&pool, &pool_offsets](const std::string &str) {
+    auto it = pool_offsets.find(str);
+    if (it != pool_offsets.end()) {
+      return it->second;
+    }
+    uint32_t offset = static_cast<uint32_t>(pool.size());
+    pool.append(str.c_str(), str.size() + 1);
+    pool_offsets[str] = offset;
+    return offset;
+  };
+
+  std::vector<KeyMapCacheEntry> entries(key_map.size());
+  for (size_t i = 0; i < key_map.size(); ++i) {
+    entries[i].code = intern(key_map[i].code);
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      entries[i].values[level] = intern(key_map[i].values[level]);
+    }
+  }
+
+  KeyMapCacheHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.fingerprint = fingerprint;
+  header.entry_count = static_cast<uint32_t>(entries.size());
+  header.string_pool_size = static_cast<uint32_t>(pool.size());
+
+  dst->clear();
+  dst->reserve(sizeof(header) + entries.size() * sizeof(KeyMapCacheEntry) + pool.size());
+  dst->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  dst->append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(KeyMapCacheEntry));
+  dst->append(pool);
+}
+
+bool ReadKeyMapCacheFile(const std::string &directory, uint64_t fingerprint, KeyMap *dst) {
+  std::string path = directory + "/" + GetCacheFileName(fingerprint);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+
+  bool result = false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      result = UnpackKeyMap(static_cast<const char*>(data), st.st_size, fingerprint, dst);
+      munmap(data, st.st_size);
+    }
+  }
+
+  close(fd);
+  return result;
+}
+
+bool WriteKeyMapCacheFile(const std::string &directory, uint64_t fingerprint, const KeyMap &key_map) {
+  std::string packed;
+  PackKeyMap(fingerprint, key_map, &packed);
+  return WriteCacheFile(directory, GetCacheFileName(fingerprint), packed);
+}
+
+bool WriteCacheFile(const std::string &directory, const std::string &name, const std::string &data) {
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    return false;
+  }
+
+  // Write to a temporary file first, so that readers never see a partial file
+  std::string path = directory + "/" + name;
+  std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool written = (fwrite(data.data(), 1, data.size(), file) == data.size());
+  written = (fclose(file) == 0) && written;
+
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace vscode_keyboard
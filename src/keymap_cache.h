@@ -0,0 +1,37 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYMAP_CACHE_H_
+#define KEYMAP_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "keymap.h"
+
+namespace vscode_keyboard {
+
+// Keymaps are packed into a table that can be used straight from a read-only
+// memory mapping: a header, one fixed size entry per code, and a pool of
+// NUL-terminated UTF-8 strings the entries point into.
+void PackKeyMap(uint64_t fingerprint, const KeyMap &key_map, std::string *dst);
+
+// Fills the values of the codes already present in `dst`. Fails if the table is
+// malformed, has a different fingerprint or was packed for a different set of codes.
+bool UnpackKeyMap(const char *data, size_t size, uint64_t fingerprint, KeyMap *dst);
+
+// The disk cache holds one packed table per layout fingerprint.
+// Fills the values of the codes already present in `dst`. Fails if there is no
+// file for `fingerprint` or if it was written for a different set of codes.
+bool ReadKeyMapCacheFile(const std::string &directory, uint64_t fingerprint, KeyMap *dst);
+bool WriteKeyMapCacheFile(const std::string &directory, uint64_t fingerprint, const KeyMap &key_map);
+
+// Creates `directory` if needed and replaces the file `name` in it with `data`
+// through a temporary file, so that readers never see a partially written file.
+bool WriteCacheFile(const std::string &directory, const std::string &name, const std::string &data);
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYMAP_CACHE_H_
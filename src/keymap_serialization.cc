@@ -0,0 +1,136 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keymap_serialization.h"
+
+#include <string.h>
+
+namespace vscode_keyboard {
+
+namespace {
+
+// Layout:
+//   magic (4 bytes), version (1 byte), flags (1 byte), codes hash (8 bytes),
+//   varint code count, varint record count, records.
+// A record is: varint distance to the previous record's code index, a byte with
+// one bit per level that is stored, and a varint length plus UTF-8 bytes per stored level.
+const unsigned char kMagic[4] = {'N', 'K', 'M', 'D'};
+const unsigned char kVersion = 1;
+const unsigned char kDeltaFlag = 1;
+
+uint64_t HashCodes(const KeyMap &key_map) {
+  uint64_t hash = kHashSeed;
+  for (const KeyMapping &mapping : key_map) {
+    hash = HashBytes(mapping.code, strlen(mapping.code) + 1, hash);
+  }
+  return hash;
+}
+
+} // namespace
+
+void WriteVarint(uint64_t value, std::string *dst) {
+  while (value >= 0x80) {
+    dst->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  dst->push_back(static_cast<char>(value));
+}
+
+void SerializeKeyMap(const KeyMap &key_map, const KeyMap *delta_baseline, std::string *dst) {
+  if (delta_baseline && delta_baseline->size() != key_map.size()) {
+    delta_baseline = NULL;
+  }
+
+  std::string records;
+  size_t record_count = 0;
+  size_t previous_index = 0;
+  for (size_t i = 0; i < key_map.size(); ++i) {
+    unsigned char level_mask = 0;
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      const std::string &value = key_map[i].values[level];
+      if (delta_baseline ? value != (*delta_baseline)[i].values[level] : !value.empty()) {
+        level_mask |= (1 << level);
+      }
+    }
+    if (!level_mask) {
+      continue;
+    }
+
+    WriteVarint(i - previous_index, &records);
+    records.push_back(static_cast<char>(level_mask));
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      if (level_mask & (1 << level)) {
+        const std::string &value = key_map[i].values[level];
+        WriteVarint(value.size(), &records);
+        records.append(value);
+      }
+    }
+    previous_index = i;
+    ++record_count;
+  }
+
+  uint64_t codes_hash = HashCodes(key_map);
+
+  dst->clear();
+  dst->append(reinterpret_cast<const char*>(kMagic), sizeof(kMagic));
+  dst->push_back(static_cast<char>(kVersion));
+  dst->push_back(static_cast<char>(delta_baseline ? kDeltaFlag : 0));
+  dst->append(reinterpret_cast<const char*>(&codes_hash), sizeof(codes_hash));
+  WriteVarint(key_map.size(), dst);
+  WriteVarint(record_count, dst);
+  dst->append(records);
+}
+
+bool DeserializeKeyMap(const unsigned char *data, size_t size, const KeyMap &delta_baseline, KeyMap *dst) {
+  ByteReader reader(data, size);
+
+  unsigned char magic[sizeof(kMagic)];
+  unsigned char version;
+  unsigned char flags;
+  uint64_t codes_hash;
+  uint64_t code_count;
+  uint64_t record_count;
+  if (!reader.ReadBytes(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0
+      || !reader.ReadByte(&version) || version != kVersion
+      || !reader.ReadByte(&flags)
+      || !reader.ReadBytes(&codes_hash, sizeof(codes_hash)) || codes_hash != HashCodes(*dst)
+      || !reader.ReadVarint(&code_count) || code_count != dst->size()
+      || !reader.ReadVarint(&record_count)) {
+    return false;
+  }
+
+  bool is_delta = (flags & kDeltaFlag);
+  if (is_delta && delta_baseline.size() != dst->size()) {
+    return false;
+  }
+  for (size_t i = 0; i < dst->size(); ++i) {
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      (*dst)[i].values[level] = (is_delta ? delta_baseline[i].values[level] : std::string());
+    }
+  }
+
+  uint64_t index = 0;
+  for (uint64_t record = 0; record < record_count; ++record) {
+    uint64_t distance;
+    unsigned char level_mask;
+    if (!reader.ReadVarint(&distance) || !reader.ReadByte(&level_mask)) {
+      return false;
+    }
+    index += distance;
+    if (index >= dst->size()) {
+      return false;
+    }
+
+    for (size_t level = 0; level < kLevelCount; ++level) {
+      if ((level_mask & (1 << level)) && !reader.ReadString(&(*dst)[index].values[level])) {
+        return false;
+      }
+    }
+  }
+
+  return reader.AtEnd();
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,88 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYMAP_SERIALIZATION_H_
+#define KEYMAP_SERIALIZATION_H_
+
+#include <string.h>
+
+#include <string>
+
+#include "keymap.h"
+
+namespace vscode_keyboard {
+
+// A compact encoding of keymaps for sending them to other processes. Only the
+// levels that differ from a baseline are stored: either from a keymap with
+// empty values or, when `delta_baseline` is given, from that keymap (which must
+// have the same codes). Both sides must be built with the same keycode table.
+void SerializeKeyMap(const KeyMap &key_map, const KeyMap *delta_baseline, std::string *dst);
+
+// Fills the values of the codes already present in `dst`. `delta_baseline` is
+// used if the data was serialized against a baseline.
+bool DeserializeKeyMap(const unsigned char *data, size_t size, const KeyMap &delta_baseline, KeyMap *dst);
+
+// Appends `value` in 7-bit groups, least significant first.
+void WriteVarint(uint64_t value, std::string *dst);
+
+// Reads what `WriteVarint` and friends wrote. Every read fails at the end of the data.
+class ByteReader {
+ public:
+  ByteReader(const unsigned char *data, size_t size) : data_(data), end_(data + size) {}
+
+  bool ReadByte(unsigned char *value) {
+    if (data_ == end_) {
+      return false;
+    }
+    *value = *data_++;
+    return true;
+  }
+
+  bool ReadBytes(void *dst, size_t size) {
+    if (static_cast<size_t>(end_ - data_) < size) {
+      return false;
+    }
+    memcpy(dst, data_, size);
+    data_ += size;
+    return true;
+  }
+
+  bool ReadVarint(uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      unsigned char byte;
+      if (!ReadByte(&byte)) {
+        return false;
+      }
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadString(std::string *value) {
+    uint64_t length;
+    if (!ReadVarint(&length) || static_cast<uint64_t>(end_ - data_) < length) {
+      return false;
+    }
+    value->assign(reinterpret_cast<const char*>(data_), length);
+    data_ += length;
+    return true;
+  }
+
+  bool AtEnd() const {
+    return data_ == end_;
+  }
+
+ private:
+  const unsigned char *data_;
+  const unsigned char *end_;
+};
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYMAP_SERIALIZATION_H_
@@ -0,0 +1,204 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "keymap_shm.h"
+#include "keymap_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+
+namespace vscode_keyboard {
+
+namespace {
+
+const char kMagic[4] = {'N', 'K', 'M', 'S'};
+const uint32_t kVersion = 2;
+
+// Large enough for the packed keymap of every layout, which takes about 8KB.
+const uint32_t kCapacity = 64 * 1024;
+
+// Seqlock readers give up after this many attempts in case the publisher keeps writing.
+const int kMaxReadAttempts = 16;
+
+std::string GetSegmentName(const std::string &name) {
+  std::string result = "/";
+  for (char c : name) {
+    result += (c == '/' ? '_' : c);
+  }
+  return result;
+}
+
+// The process id and a random nonce, which tell apart publishers that got the same pid
+uint64_t CreatePublisherGeneration() {
+  std::random_device random;
+  return (static_cast<uint64_t>(getpid()) << 32) | random();
+}
+
+} // namespace
+
+bool operator==(const SharedKeyMapVersion &a, const SharedKeyMapVersion &b) {
+  return a.generation == b.generation && a.epoch == b.epoch;
+}
+
+struct SharedKeyMapSegment::Layout {
+  char magic[4];
+  uint32_t version;
+  // Odd while the publisher is writing
+  std::atomic<uint32_t> sequence;
+  uint32_t size;
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> epoch;
+  char data[kCapacity];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "The sequence lock must work across processes");
+
+SharedKeyMapSegment::SharedKeyMapSegment(int fd, Layout *layout, const std::string &unlink_name)
+    : fd_(fd), layout_(layout), unlink_name_(unlink_name) {}
+
+SharedKeyMapSegment::~SharedKeyMapSegment() {
+  munmap(layout_, sizeof(Layout));
+  // Unlinked while the lock is still held, so that it never unlinks the segment of the next publisher
+  if (!unlink_name_.empty()) {
+    shm_unlink(unlink_name_.c_str());
+  }
+  close(fd_);
+}
+
+SharedKeyMapSegment* SharedKeyMapSegment::OpenForPublishing(const std::string &name) {
+  std::string segment_name = GetSegmentName(name);
+  int fd = shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  // The lock is held for as long as the segment is open, so there is only ever one publisher
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, sizeof(Layout)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  Layout *layout = static_cast<Layout*>(data);
+  // Readers ignore the segment until the header is complete
+  layout->version = kVersion;
+  memcpy(layout->magic, kMagic, sizeof(kMagic));
+
+  // The keymap of a previous publisher, which may have crashed, is no longer valid
+  uint32_t sequence = layout->sequence.load(std::memory_order_relaxed) | 1;
+  layout->sequence.store(sequence, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  layout->size = 0;
+  layout->generation.store(CreatePublisherGeneration(), std::memory_order_relaxed);
+  layout->epoch.store(0, std::memory_order_relaxed);
+  layout->sequence.store(sequence + 1, std::memory_order_release);
+
+  return new SharedKeyMapSegment(fd, layout, segment_name);
+}
+
+SharedKeyMapSegment* SharedKeyMapSegment::OpenForReading(const std::string &name) {
+  int fd = shm_open(GetSegmentName(name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Layout)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, sizeof(Layout), PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  return new SharedKeyMapSegment(fd, static_cast<Layout*>(data), std::string());
+}
+
+bool SharedKeyMapSegment::Write(uint64_t epoch, const KeyMap &key_map) {
+  std::string packed;
+  PackKeyMap(0, key_map, &packed);
+  if (packed.size() > kCapacity) {
+    return false;
+  }
+
+  uint32_t sequence = layout_->sequence.load(std::memory_order_relaxed);
+  layout_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy(layout_->data, packed.data(), packed.size());
+  layout_->size = static_cast<uint32_t>(packed.size());
+  layout_->epoch.store(epoch, std::memory_order_relaxed);
+
+  layout_->sequence.store(sequence + 2, std::memory_order_release);
+  return true;
+}
+
+bool SharedKeyMapSegment::IsPublisherAlive() const {
+  // The publisher holds an exclusive lock until it closes the segment or exits
+  if (flock(fd_, LOCK_SH | LOCK_NB) == 0) {
+    flock(fd_, LOCK_UN);
+    return false;
+  }
+  return errno == EWOULDBLOCK;
+}
+
+bool SharedKeyMapSegment::ReadVersion(SharedKeyMapVersion *version) const {
+  return Read(NULL, version);
+}
+
+// Only reads the version if `dst` is NULL.
+bool SharedKeyMapSegment::Read(KeyMap *dst, SharedKeyMapVersion *version) const {
+  if (memcmp(layout_->magic, kMagic, sizeof(kMagic)) != 0 || layout_->version != kVersion) {
+    return false;
+  }
+
+  std::string packed;
+  for (int attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+    uint32_t sequence = layout_->sequence.load(std::memory_order_acquire);
+    if (sequence == 0 || (sequence & 1)) {
+      continue;
+    }
+
+    uint32_t size = layout_->size;
+    if (size > kCapacity) {
+      continue;
+    }
+    if (dst) {
+      packed.assign(layout_->data, size);
+    }
+    version->generation = layout_->generation.load(std::memory_order_relaxed);
+    version->epoch = layout_->epoch.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (layout_->sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+    if (version->epoch == 0) {
+      return false;
+    }
+    // The copy is consistent, but it is still validated in case of a misbehaving publisher
+    return !dst || UnpackKeyMap(packed.data(), packed.size(), 0, dst);
+  }
+  return false;
+}
+
+}  // namespace vscode_keyboard
@@ -0,0 +1,64 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef KEYMAP_SHM_H_
+#define KEYMAP_SHM_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "keymap.h"
+
+namespace vscode_keyboard {
+
+// Identifies a published keymap. Every publisher has a generation of its own,
+// because the epochs of a restarted publisher start over.
+typedef struct {
+  uint64_t generation;
+  uint64_t epoch;
+} SharedKeyMapVersion;
+
+bool operator==(const SharedKeyMapVersion &a, const SharedKeyMapVersion &b);
+
+// A named shared memory segment through which one process publishes its keymap
+// to others. The keymap is stored as a packed table (see keymap_cache.h) and
+// guarded by a sequence lock, so readers never block the publisher.
+class SharedKeyMapSegment {
+ public:
+  // Creates the segment. Fails if another process already publishes into it.
+  // The segment is unlinked when the publisher closes it.
+  static SharedKeyMapSegment* OpenForPublishing(const std::string &name);
+  static SharedKeyMapSegment* OpenForReading(const std::string &name);
+  ~SharedKeyMapSegment();
+
+  bool Write(uint64_t epoch, const KeyMap &key_map);
+
+  // Readers only. Returns false once the process that published into the
+  // segment has exited, until another one publishes into it.
+  bool IsPublisherAlive() const;
+
+  // Returns false if nothing was published yet.
+  bool ReadVersion(SharedKeyMapVersion *version) const;
+
+  // Fills the values of the codes already present in `dst`.
+  bool Read(KeyMap *dst, SharedKeyMapVersion *version) const;
+
+ private:
+  struct Layout;
+
+  SharedKeyMapSegment(int fd, Layout *layout, const std::string &unlink_name);
+
+  int fd_;
+  Layout *layout_;
+  // The segment to unlink on closing, empty for readers
+  std::string unlink_name_;
+
+  SharedKeyMapSegment(const SharedKeyMapSegment&) = delete;
+  SharedKeyMapSegment& operator=(const SharedKeyMapSegment&) = delete;
+};
+
+}  // namespace vscode_keyboard
+
+#endif  // KEYMAP_SHM_H_
@@ -5,9 +5,12 @@
 
 #define NODE_API_EXPERIMENTAL_NOGC_ENV_OPT_OUT
 #include <node.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
 
 #include "keymapping.h"
+#include "keybinding_resolver.h"
 #include "common.h"
 
 namespace vscode_keyboard {
@@ -26,6 +29,66 @@ napi_status napi_set_named_property_int32(napi_env env, napi_value object, const
   return napi_ok;
 }
 
+// Leaves `value` untouched if the property is missing or not a number.
+napi_status napi_get_named_property_int32(napi_env env, napi_value object, const char *utf8_name, int *value) {
+  napi_value _value;
+  NAPI_CALL_RETURN_STATUS(env, napi_get_named_property(env, object, utf8_name, &_value));
+  napi_valuetype valuetype;
+  NAPI_CALL_RETURN_STATUS(env, napi_typeof(env, _value, &valuetype));
+  if (valuetype == napi_number) {
+    NAPI_CALL_RETURN_STATUS(env, napi_get_value_int32(env, _value, value));
+  }
+  return napi_ok;
+}
+
+// Leaves `value` untouched if the property is missing or not a string.
+napi_status napi_get_named_property_string_utf8(napi_env env, napi_value object, const char *utf8_name, std::string *value) {
+  napi_value _value;
+  NAPI_CALL_RETURN_STATUS(env, napi_get_named_property(env, object, utf8_name, &_value));
+  napi_valuetype valuetype;
+  NAPI_CALL_RETURN_STATUS(env, napi_typeof(env, _value, &valuetype));
+  if (valuetype == napi_string) {
+    size_t length;
+    NAPI_CALL_RETURN_STATUS(env, napi_get_value_string_utf8(env, _value, NULL, 0, &length));
+    value->resize(length + 1);
+    NAPI_CALL_RETURN_STATUS(env, napi_get_value_string_utf8(env, _value, &(*value)[0], value->size(), &length));
+    value->resize(length);
+  }
+  return napi_ok;
+}
+
+// Fails with napi_invalid_arg if `value` is not a Uint32Array.
+napi_status napi_get_value_uint32_array(napi_env env, napi_value value, uint32_t **data, size_t *length) {
+  bool is_typedarray;
+  NAPI_CALL_RETURN_STATUS(env, napi_is_typedarray(env, value, &is_typedarray));
+  if (!is_typedarray) {
+    return napi_invalid_arg;
+  }
+  napi_typedarray_type type;
+  void *_data;
+  NAPI_CALL_RETURN_STATUS(env, napi_get_typedarray_info(env, value, &type, length, &_data, NULL, NULL));
+  if (type != napi_uint32_array) {
+    return napi_invalid_arg;
+  }
+  *data = static_cast<uint32_t*>(_data);
+  return napi_ok;
+}
+
+static napi_status napi_create_typedarray_with_buffer(napi_env env, napi_typedarray_type type, size_t length, size_t element_size, void **data, napi_value *result) {
+  napi_value buffer;
+  NAPI_CALL_RETURN_STATUS(env, napi_create_arraybuffer(env, length * element_size, data, &buffer));
+  NAPI_CALL_RETURN_STATUS(env, napi_create_typedarray(env, type, length, buffer, 0, result));
+  return napi_ok;
+}
+
+napi_status napi_create_int32_array(napi_env env, size_t length, int32_t **data, napi_value *result) {
+  return napi_create_typedarray_with_buffer(env, napi_int32_array, length, sizeof(int32_t), reinterpret_cast<void**>(data), result);
+}
+
+napi_status napi_create_uint32_array(napi_env env, size_t length, uint32_t **data, napi_value *result) {
+  return napi_create_typedarray_with_buffer(env, napi_uint32_array, length, sizeof(uint32_t), reinterpret_cast<void**>(data), result);
+}
+
 napi_value napi_fetch_null(napi_env env) {
   napi_value result;
   NAPI_CALL(env, napi_get_null(env, &result));
@@ -44,20 +107,67 @@ napi_value napi_fetch_boolean(napi_env env, bool value) {
   return result;
 }
 
+napi_status CreateKeyboardSnapshotObject(napi_env env, uint64_t epoch, napi_value layout, napi_value key_map, napi_value is_iso_keyboard, napi_value *result) {
+  NAPI_CALL_RETURN_STATUS(env, napi_create_object(env, result));
+
+  napi_value epoch_value;
+  NAPI_CALL_RETURN_STATUS(env, napi_create_int64(env, epoch, &epoch_value));
+  NAPI_CALL_RETURN_STATUS(env, napi_set_named_property(env, *result, "epoch", epoch_value));
+  NAPI_CALL_RETURN_STATUS(env, napi_set_named_property(env, *result, "layout", layout));
+  NAPI_CALL_RETURN_STATUS(env, napi_set_named_property(env, *result, "keyMap", key_map));
+  NAPI_CALL_RETURN_STATUS(env, napi_set_named_property(env, *result, "isISOKeyboard", is_iso_keyboard));
+  return napi_ok;
+}
+
+// Advanced whenever a keyboard layout change is observed
+static std::atomic<uint64_t> layout_epoch(0);
+
+uint64_t AdvanceLayoutEpoch() {
+  return ++layout_epoch;
+}
+
+uint64_t GetLayoutEpoch() {
+  return layout_epoch.load(std::memory_order_acquire);
+}
+
 void InvokeNotificationCallback(NotificationCallbackData *data) {
+  CallNotificationCallback(data, AdvanceLayoutEpoch());
+}
+
+void CallNotificationCallback(NotificationCallbackData *data, uint64_t epoch) {
   if (data->tsfn == NULL) {
     // This indicates we are in the shutdown phase and the thread safe function has been finalized
     return;
   }
 
+  data->queue.Push(epoch);
+  if (!data->queue.RequestWakeup()) {
+    // The JS thread has not yet picked up the previous wakeup and will see this record too
+    return;
+  }
+
   // No need to call napi_acquire_threadsafe_function because
   // the refcount is set to 1 in the main thread.
-  napi_call_threadsafe_function(data->tsfn, NULL, napi_tsfn_blocking);
+  // With a single pending wakeup, the queue of the thread safe function never fills up.
+  if (napi_call_threadsafe_function(data->tsfn, NULL, napi_tsfn_nonblocking) != napi_ok) {
+    data->queue.ClearWakeup();
+  }
 }
 
+// Calls back once for all the changes recorded since the last call, since the
+// callback takes no arguments and reads the current layout itself
 static void NotifyJS(napi_env env, napi_value func, void* context, void* data) {
+  NotificationCallbackData *callback_data = static_cast<NotificationCallbackData*>(context);
+  callback_data->queue.ClearWakeup();
+
+  bool changed = false;
+  uint64_t epoch;
+  while (callback_data->queue.Pop(&epoch)) {
+    changed = true;
+  }
+
   // env may be NULL if nodejs is shutting down
-  if (env != NULL) {
+  if (env != NULL && changed) {
     napi_value global;
     NAPI_CALL_RETURN_VOID(env, napi_get_global(env, &global));
 
@@ -66,6 +176,61 @@ static void NotifyJS(napi_env env, napi_value func, void* context, void* data) {
   }
 }
 
+void CallModifierStateCallback(NotificationCallbackData *data, uint32_t sequence, uint32_t state) {
+  if (data->modifier_state_tsfn == NULL) {
+    return;
+  }
+
+  data->modifier_state_queue.Push((static_cast<uint64_t>(sequence) << 32) | state);
+  if (!data->modifier_state_queue.RequestWakeup()) {
+    return;
+  }
+
+  if (napi_call_threadsafe_function(data->modifier_state_tsfn, NULL, napi_tsfn_nonblocking) != napi_ok) {
+    data->modifier_state_queue.ClearWakeup();
+  }
+}
+
+// Delivers all the states recorded since the last call in one batch
+static void NotifyModifierStateJS(napi_env env, napi_value func, void* context, void* data) {
+  NotificationCallbackData *callback_data = static_cast<NotificationCallbackData*>(context);
+  callback_data->modifier_state_queue.ClearWakeup();
+
+  // env may be NULL if nodejs is shutting down
+  if (env != NULL) {
+    std::vector<uint32_t> states;
+    uint64_t record;
+    while (callback_data->modifier_state_queue.Pop(&record)) {
+      states.push_back(static_cast<uint32_t>(record));
+    }
+    if (states.empty()) {
+      return;
+    }
+
+    napi_value global;
+    NAPI_CALL_RETURN_VOID(env, napi_get_global(env, &global));
+
+    napi_value states_array;
+    uint32_t *states_data;
+    NAPI_CALL_RETURN_VOID(env, napi_create_uint32_array(env, states.size(), &states_data, &states_array));
+    std::copy(states.begin(), states.end(), states_data);
+
+    napi_value argv[1] = { states_array };
+    NAPI_CALL_RETURN_VOID(env, napi_call_function(env, global, func, 1, argv, NULL));
+  }
+}
+
+static void FinalizeModifierStateThreadsafeFunction(napi_env env, void* raw_data, void* hint) {
+  NotificationCallbackData *data;
+  napi_get_instance_data(env, (void**)&data);
+  data->modifier_state_tsfn = NULL;
+}
+
+static void ModifierStateCleanupHook(void *raw_data) {
+  NotificationCallbackData* data = static_cast<NotificationCallbackData*>(raw_data);
+  DisposeModifierStateListenerImpl(data);
+}
+
 static void FinalizeThreadsafeFunction(napi_env env, void* raw_data, void* hint) {
   NotificationCallbackData *data;
   napi_get_instance_data(env, (void**)&data);
@@ -97,8 +262,8 @@ napi_value OnDidChangeKeyboardLayoutImpl(napi_env env, napi_callback_info info)
 
   // Convert the callback retrieved from JavaScript into a thread-safe function
   napi_threadsafe_function tsfn;
-  NAPI_CALL(env, napi_create_threadsafe_function(env, func, NULL, resource_name, 0, 1, NULL,
-                                                 FinalizeThreadsafeFunction, NULL, NotifyJS,
+  NAPI_CALL(env, napi_create_threadsafe_function(env, func, NULL, resource_name, 1, 1, NULL,
+                                                 FinalizeThreadsafeFunction, data, NotifyJS,
                                                  &tsfn));
   data->tsfn = tsfn;
 
@@ -109,8 +274,54 @@ napi_value OnDidChangeKeyboardLayoutImpl(napi_env env, napi_callback_info info)
   return napi_fetch_undefined(env);
 }
 
+napi_value OnDidChangeModifierStateImpl(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value args[1];
+  NotificationCallbackData *data;
+  NAPI_CALL(env, napi_get_instance_data(env, (void**)&data));
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+
+  NAPI_ASSERT(env, argc == 1, "Wrong number of arguments. Expects a single argument.");
+
+  napi_valuetype valuetype0;
+  NAPI_CALL(env, napi_typeof(env, args[0], &valuetype0));
+  NAPI_ASSERT(env, valuetype0 == napi_function, "Wrong type of arguments. Expects a function as first argument.");
+  NAPI_ASSERT(env, data->modifier_state_tsfn == NULL, "A modifier state listener is already registered.");
+
+  napi_value resource_name;
+  NAPI_CALL(env, napi_create_string_utf8(env, "onDidChangeModifierStateCallback", NAPI_AUTO_LENGTH, &resource_name));
+
+  napi_threadsafe_function tsfn;
+  NAPI_CALL(env, napi_create_threadsafe_function(env, args[0], NULL, resource_name, 1, 1, NULL,
+                                                 FinalizeModifierStateThreadsafeFunction, data, NotifyModifierStateJS,
+                                                 &tsfn));
+  data->modifier_state_tsfn = tsfn;
+
+  RegisterModifierStateListenerImpl(data);
+
+  napi_add_env_cleanup_hook(env, ModifierStateCleanupHook, data);
+
+  return napi_fetch_undefined(env);
+}
+
+napi_value GetDroppedNotificationCountImpl(napi_env env, napi_callback_info info) {
+  NotificationCallbackData *data;
+  NAPI_CALL(env, napi_get_instance_data(env, (void**)&data));
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_int64(env, data->queue.dropped(), &result));
+  return result;
+}
+
+napi_value GetLayoutEpochImpl(napi_env env, napi_callback_info info) {
+  napi_value result;
+  NAPI_CALL(env, napi_create_int64(env, GetLayoutEpoch(), &result));
+  return result;
+}
+
 void DeleteInstanceData(napi_env env, void *raw_data, void *hint) {
   NotificationCallbackData *data = static_cast<NotificationCallbackData*>(raw_data);
+  delete data->keybinding_resolver;
   delete data;
 }
 
@@ -138,6 +349,141 @@ napi_value Init(napi_env env, napi_value exports) {
     NAPI_CALL(env, napi_create_function(env, NULL, 0, IsISOKeyboardImpl, NULL, &is_iso_keyboard_fn));
     NAPI_CALL(env, napi_set_named_property(env, exports, "isISOKeyboard", is_iso_keyboard_fn));
   }
+  {
+    napi_value get_key_map_diff_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyMapDiffImpl, NULL, &get_key_map_diff_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyMapDiff", get_key_map_diff_fn));
+  }
+  {
+    napi_value on_did_change_modifier_state_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, OnDidChangeModifierStateImpl, NULL, &on_did_change_modifier_state_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "onDidChangeModifierState", on_did_change_modifier_state_fn));
+  }
+  {
+    napi_value get_dropped_notification_count_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetDroppedNotificationCountImpl, NULL, &get_dropped_notification_count_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getDroppedNotificationCount", get_dropped_notification_count_fn));
+  }
+  {
+    napi_value get_layout_epoch_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetLayoutEpochImpl, NULL, &get_layout_epoch_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getLayoutEpoch", get_layout_epoch_fn));
+  }
+  {
+    napi_value get_keyboard_snapshot_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyboardSnapshotImpl, NULL, &get_keyboard_snapshot_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyboardSnapshot", get_keyboard_snapshot_fn));
+  }
+  {
+    napi_value set_connection_options_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SetConnectionOptionsImpl, NULL, &set_connection_options_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "setConnectionOptions", set_connection_options_fn));
+  }
+  {
+    napi_value get_key_map_fast_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyMapFastImpl, NULL, &get_key_map_fast_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyMapFast", get_key_map_fast_fn));
+  }
+  {
+    napi_value set_key_map_cache_directory_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SetKeyMapCacheDirectoryImpl, NULL, &set_key_map_cache_directory_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "setKeyMapCacheDirectory", set_key_map_cache_directory_fn));
+  }
+  {
+    napi_value publish_shared_key_map_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, PublishSharedKeyMapImpl, NULL, &publish_shared_key_map_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "publishSharedKeyMap", publish_shared_key_map_fn));
+  }
+  {
+    napi_value subscribe_shared_key_map_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SubscribeSharedKeyMapImpl, NULL, &subscribe_shared_key_map_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "subscribeSharedKeyMap", subscribe_shared_key_map_fn));
+  }
+  {
+    napi_value serialize_key_map_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SerializeKeyMapImpl, NULL, &serialize_key_map_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "serializeKeyMap", serialize_key_map_fn));
+  }
+  {
+    napi_value deserialize_key_map_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, DeserializeKeyMapImpl, NULL, &deserialize_key_map_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "deserializeKeyMap", deserialize_key_map_fn));
+  }
+  {
+    napi_value get_key_map_fingerprint_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyMapFingerprintImpl, NULL, &get_key_map_fingerprint_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyMapFingerprint", get_key_map_fingerprint_fn));
+  }
+  {
+    napi_value translate_keys_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, TranslateKeysImpl, NULL, &translate_keys_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "translateKeys", translate_keys_fn));
+  }
+  {
+    napi_value get_dom_codes_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetDomCodesImpl, NULL, &get_dom_codes_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getDomCodes", get_dom_codes_fn));
+  }
+  {
+    napi_value convert_keycodes_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, ConvertKeycodesImpl, NULL, &convert_keycodes_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "convertKeycodes", convert_keycodes_fn));
+  }
+  {
+    napi_value get_key_classes_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyClassesImpl, NULL, &get_key_classes_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyClasses", get_key_classes_fn));
+  }
+  {
+    napi_value get_compose_result_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetComposeResultImpl, NULL, &get_compose_result_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getComposeResult", get_compose_result_fn));
+  }
+  {
+    napi_value find_compose_sequences_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, FindComposeSequencesImpl, NULL, &find_compose_sequences_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "findComposeSequences", find_compose_sequences_fn));
+  }
+  {
+    napi_value get_modifier_state_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetModifierStateImpl, NULL, &get_modifier_state_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getModifierState", get_modifier_state_fn));
+  }
+  {
+    napi_value get_keyboard_type_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyboardTypeImpl, NULL, &get_keyboard_type_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyboardType", get_keyboard_type_fn));
+  }
+  {
+    napi_value get_keyboard_geometry_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, GetKeyboardGeometryImpl, NULL, &get_keyboard_geometry_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "getKeyboardGeometry", get_keyboard_geometry_fn));
+  }
+  {
+    napi_value set_keyboard_group_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SetKeyboardGroupImpl, NULL, &set_keyboard_group_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "setKeyboardGroup", set_keyboard_group_fn));
+  }
+  {
+    napi_value set_keyboard_layout_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SetKeyboardLayoutImpl, NULL, &set_keyboard_layout_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "setKeyboardLayout", set_keyboard_layout_fn));
+  }
+  {
+    napi_value set_keybindings_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, SetKeybindingsImpl, NULL, &set_keybindings_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "setKeybindings", set_keybindings_fn));
+  }
+  {
+    napi_value resolve_keybindings_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, ResolveKeybindingsImpl, NULL, &resolve_keybindings_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "resolveKeybindings", resolve_keybindings_fn));
+  }
+  {
+    napi_value identify_layout_fn;
+    NAPI_CALL(env, napi_create_function(env, NULL, 0, IdentifyLayoutImpl, NULL, &identify_layout_fn));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "identifyLayout", identify_layout_fn));
+  }
 
   return exports;
 }
@@ -11,13 +11,12 @@
 #include <string>
 #include <vector>
 #include "../deps/chromium/keyboard_codes.h"
-
-#if defined(__unix__)
-#include <pthread.h>
-#endif
+#include "notification_queue.h"
 
 namespace vscode_keyboard {
 
+class KeybindingResolver;
+
 // This structure is used to define the keycode mapping table.
 // It is defined here because the unittests need access to it.
 typedef struct {
@@ -40,25 +39,65 @@ typedef struct {
 typedef struct {
 #if defined(_WIN32)
   void* listener;
-#endif
-#if defined(__unix__)
-  pthread_t tid;
 #endif
   volatile napi_threadsafe_function tsfn;
+  NotificationQueue queue;
+  volatile napi_threadsafe_function modifier_state_tsfn;
+  // Records hold a sequence number in the upper and a modifier state in the lower 32 bits
+  NotificationQueue modifier_state_queue;
+  // The keybindings of this env, created by the first `setKeybindings`
+  KeybindingResolver *keybinding_resolver;
 } NotificationCallbackData;
 
 napi_value GetKeyMapImpl(napi_env env, napi_callback_info info);
 napi_value GetCurrentKeyboardLayoutImpl(napi_env env, napi_callback_info info);
 void RegisterKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data);
 void DisposeKeyboardLayoutChangeListenerImpl(NotificationCallbackData *data);
+void RegisterModifierStateListenerImpl(NotificationCallbackData *data);
+void DisposeModifierStateListenerImpl(NotificationCallbackData *data);
 napi_value IsISOKeyboardImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyMapDiffImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyboardSnapshotImpl(napi_env env, napi_callback_info info);
+napi_value SetConnectionOptionsImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyMapFastImpl(napi_env env, napi_callback_info info);
+napi_value SetKeyMapCacheDirectoryImpl(napi_env env, napi_callback_info info);
+napi_value PublishSharedKeyMapImpl(napi_env env, napi_callback_info info);
+napi_value SubscribeSharedKeyMapImpl(napi_env env, napi_callback_info info);
+napi_value SerializeKeyMapImpl(napi_env env, napi_callback_info info);
+napi_value DeserializeKeyMapImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyMapFingerprintImpl(napi_env env, napi_callback_info info);
+napi_value TranslateKeysImpl(napi_env env, napi_callback_info info);
+napi_value GetDomCodesImpl(napi_env env, napi_callback_info info);
+napi_value ConvertKeycodesImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyClassesImpl(napi_env env, napi_callback_info info);
+napi_value GetComposeResultImpl(napi_env env, napi_callback_info info);
+napi_value FindComposeSequencesImpl(napi_env env, napi_callback_info info);
+napi_value GetModifierStateImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyboardTypeImpl(napi_env env, napi_callback_info info);
+napi_value GetKeyboardGeometryImpl(napi_env env, napi_callback_info info);
+napi_value SetKeyboardGroupImpl(napi_env env, napi_callback_info info);
+napi_value SetKeyboardLayoutImpl(napi_env env, napi_callback_info info);
+napi_value SetKeybindingsImpl(napi_env env, napi_callback_info info);
+napi_value ResolveKeybindingsImpl(napi_env env, napi_callback_info info);
+napi_value IdentifyLayoutImpl(napi_env env, napi_callback_info info);
 
 void InvokeNotificationCallback(NotificationCallbackData *data);
+// Like `InvokeNotificationCallback`, for backends that notify several envs about one change.
+void CallNotificationCallback(NotificationCallbackData *data, uint64_t epoch);
+void CallModifierStateCallback(NotificationCallbackData *data, uint32_t sequence, uint32_t state);
+uint64_t AdvanceLayoutEpoch();
+uint64_t GetLayoutEpoch();
 napi_status napi_set_named_property_string_utf8(napi_env env, napi_value object, const char *utf8_name, const char *value);
 napi_status napi_set_named_property_int32(napi_env env, napi_value object, const char *utf8_name, int value);
+napi_status napi_get_named_property_int32(napi_env env, napi_value object, const char *utf8_name, int *value);
+napi_status napi_get_named_property_string_utf8(napi_env env, napi_value object, const char *utf8_name, std::string *value);
+napi_status napi_get_value_uint32_array(napi_env env, napi_value value, uint32_t **data, size_t *length);
+napi_status napi_create_int32_array(napi_env env, size_t length, int32_t **data, napi_value *result);
+napi_status napi_create_uint32_array(napi_env env, size_t length, uint32_t **data, napi_value *result);
 napi_value napi_fetch_null(napi_env env);
 napi_value napi_fetch_undefined(napi_env env);
 napi_value napi_fetch_boolean(napi_env env, bool value);
+napi_status CreateKeyboardSnapshotObject(napi_env env, uint64_t epoch, napi_value layout, napi_value key_map, napi_value is_iso_keyboard, napi_value *result);
 
 }  // namespace vscode_keyboard
 
@@ -0,0 +1,83 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "layout_identification.h"
+
+#include <string.h>
+
+namespace vscode_keyboard {
+
+namespace {
+
+// Must match CODES in scripts/generate-known-layouts.js
+const char* const kSignatureCodes[] = {
+  "Backquote", "Digit1", "Digit2", "Digit3", "Digit4", "Digit5", "Digit6", "Digit7", "Digit8", "Digit9", "Digit0", "Minus", "Equal",
+  "KeyQ", "KeyW", "KeyE", "KeyR", "KeyT", "KeyY", "KeyU", "KeyI", "KeyO", "KeyP", "BracketLeft", "BracketRight", "Backslash",
+  "KeyA", "KeyS", "KeyD", "KeyF", "KeyG", "KeyH", "KeyJ", "KeyK", "KeyL", "Semicolon", "Quote",
+  "IntlBackslash", "KeyZ", "KeyX", "KeyC", "KeyV", "KeyB", "KeyN", "KeyM", "Comma", "Period", "Slash",
+  "IntlRo", "IntlYen"
+};
+const size_t kSignatureCodeCount = sizeof(kSignatureCodes) / sizeof(kSignatureCodes[0]);
+
+const int kBitsPerCell = 4;
+const int kCellsPerWord = 64 / kBitsPerCell;
+
+static_assert((kSignatureCodeCount * kLevelCount + kCellsPerWord - 1) / kCellsPerWord == kLayoutSignatureWords,
+              "kLayoutSignatureWords does not fit kSignatureCodes");
+
+typedef struct {
+  const char *layout;
+  const char *variant;
+  uint64_t words[kLayoutSignatureWords];
+} KnownLayout;
+
+#define KNOWN_LAYOUT(layout, variant, ...) {layout, variant, {__VA_ARGS__}},
+const KnownLayout kKnownLayouts[] = {
+#include "known_layouts_data.inc"
+};
+#undef KNOWN_LAYOUT
+
+// The top bits of the Fibonacci hash, which spreads neighbouring characters apart
+uint64_t DigestCharacter(uint32_t character) {
+  return static_cast<uint32_t>(character * 0x9e3779b1u) >> (32 - kBitsPerCell);
+}
+
+} // namespace
+
+void ComputeLayoutSignature(const KeyMap &key_map, LayoutSignature *dst) {
+  memset(dst->words, 0, sizeof(dst->words));
+  size_t cell = 0;
+  for (const char *code : kSignatureCodes) {
+    const KeyMapping *mapping = FindKeyMapping(key_map, code);
+    for (size_t level = 0; level < kLevelCount; ++level, ++cell) {
+      uint32_t character = (mapping ? DecodeCharacter(mapping->values[level]) : 0);
+      dst->words[cell / kCellsPerWord] |= DigestCharacter(character) << ((cell % kCellsPerWord) * kBitsPerCell);
+    }
+  }
+}
+
+void FindNearestLayout(const LayoutSignature &signature, LayoutMatch *match) {
+  const KnownLayout *nearest = NULL;
+  int nearest_distance = kLayoutSignatureWords * 64 + 1;
+  for (const KnownLayout &known_layout : kKnownLayouts) {
+    // The table is small enough that a plain scan with a popcount per word stays
+    // in the microseconds. The addon is built for the baseline ISA, so this is
+    // the compiler's generic bit counting rather than the POPCNT instruction.
+    int distance = 0;
+    for (size_t i = 0; i < kLayoutSignatureWords && distance < nearest_distance; ++i) {
+      distance += __builtin_popcountll(signature.words[i] ^ known_layout.words[i]);
+    }
+    if (distance < nearest_distance) {
+      nearest = &known_layout;
+      nearest_distance = distance;
+    }
+  }
+
+  match->layout = nearest->layout;
+  match->variant = nearest->variant;
+  match->distance = nearest_distance;
+}
+
+}  // namespace vscode_keyboard
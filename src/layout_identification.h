@@ -0,0 +1,39 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef LAYOUT_IDENTIFICATION_H_
+#define LAYOUT_IDENTIFICATION_H_
+
+#include <stdint.h>
+
+#include "keymap.h"
+
+namespace vscode_keyboard {
+
+// 4 bits for every level of the 50 keys of the writing system, see
+// scripts/generate-known-layouts.js. Keymaps that type different characters
+// on a key differ in some of the key's bits, unless their digests collide.
+const size_t kLayoutSignatureWords = 19;
+
+typedef struct {
+  uint64_t words[kLayoutSignatureWords];
+} LayoutSignature;
+
+typedef struct {
+  const char *layout;
+  const char *variant;
+  // The number of bits in which the signatures differ, 0 for an exact match
+  int distance;
+} LayoutMatch;
+
+void ComputeLayoutSignature(const KeyMap &key_map, LayoutSignature *dst);
+
+// Finds the xkeyboard-config layout in known_layouts_data.inc with the nearest
+// signature. Of equally near ones, the layout comes before its variants.
+void FindNearestLayout(const LayoutSignature &signature, LayoutMatch *match);
+
+}  // namespace vscode_keyboard
+
+#endif  // LAYOUT_IDENTIFICATION_H_
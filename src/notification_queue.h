@@ -0,0 +1,89 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#ifndef NOTIFICATION_QUEUE_H_
+#define NOTIFICATION_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace vscode_keyboard {
+
+// A bounded single-producer/single-consumer ring of layout epochs, passed from a
+// listener thread to the JS thread of an env. The producer never blocks: when the
+// ring is full the record is dropped from it, but it is still remembered as the
+// latest record, which the consumer delivers once it has drained the ring.
+class NotificationQueue {
+ public:
+  static const size_t kCapacity = 16;
+
+  NotificationQueue() : head_(0), tail_(0), latest_(0), dropped_(0), wakeup_pending_(false), delivered_(0) {}
+
+  // Producer side. Epochs must be increasing.
+  void Push(uint64_t epoch) {
+    latest_.store(epoch, std::memory_order_release);
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    records_[head % kCapacity] = epoch;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Producer side. Returns true if the consumer has to be woken up, which is
+  // the case for only one caller until the consumer calls `ClearWakeup`.
+  bool RequestWakeup() {
+    return !wakeup_pending_.exchange(true, std::memory_order_acq_rel);
+  }
+
+  // Consumer side. Must be called before draining, so that no wakeup is lost.
+  void ClearWakeup() {
+    wakeup_pending_.store(false, std::memory_order_release);
+  }
+
+  // Consumer side. Skips records that were already delivered as the latest one.
+  bool Pop(uint64_t *epoch) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    while (tail != head_.load(std::memory_order_acquire)) {
+      uint64_t record = records_[tail % kCapacity];
+      tail_.store(++tail, std::memory_order_release);
+      if (record > delivered_) {
+        delivered_ = *epoch = record;
+        return true;
+      }
+    }
+
+    uint64_t latest = latest_.load(std::memory_order_acquire);
+    if (latest > delivered_) {
+      delivered_ = *epoch = latest;
+      return true;
+    }
+    return false;
+  }
+
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  uint64_t records_[kCapacity];
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<uint64_t> latest_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> wakeup_pending_;
+  // Only accessed by the consumer
+  uint64_t delivered_;
+
+  NotificationQueue(const NotificationQueue&) = delete;
+  NotificationQueue& operator=(const NotificationQueue&) = delete;
+};
+
+}  // namespace vscode_keyboard
+
+#endif  // NOTIFICATION_QUEUE_H_
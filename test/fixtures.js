@@ -0,0 +1,235 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Microsoft Corporation. All rights reserved.
+ *  Licensed under the MIT License. See License.txt in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+// Checks getKeyMap against the keymaps recorded in test/linux, which the addon
+// replays instead of an X server when NATIVE_KEYMAP_FIXTURE is set, and runs the
+// checks of `CHECKS` against each of them.
+
+var assert = require('assert');
+var childProcess = require('child_process');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var workerThreads = require('worker_threads');
+
+var FIXTURES = ['en', 'de_neo', 'es', 'de_ch'];
+
+if (process.platform !== 'linux') {
+  return;
+}
+
+function checkSerialization(keymap, name) {
+  var keyMap = keymap.getKeyMap();
+  var full = keymap.serializeKeyMap(false);
+  var delta = keymap.serializeKeyMap(true);
+  assert.deepStrictEqual(keymap.deserializeKeyMap(full), keyMap, name + ': full round trip');
+  assert.deepStrictEqual(keymap.deserializeKeyMap(delta), keyMap, name + ': delta round trip');
+  // Every fixture shares most of its keys with the built-in US layout
+  assert.ok(delta.length < full.length, name + ': delta of ' + delta.length + ' bytes, full ' + full.length);
+
+  [full, delta].forEach(function(data) {
+    for (var length = 0; length < data.length; ++length) {
+      assert.strictEqual(keymap.deserializeKeyMap(data.subarray(0, length)), null, name + ': truncated to ' + length);
+    }
+  });
+  // The codes hash follows the magic, version and flags
+  var otherBuild = full.slice();
+  otherBuild[6] ^= 1;
+  assert.strictEqual(keymap.deserializeKeyMap(otherBuild), null, name + ': other codes');
+}
+
+function checkKeycodeConversion(keymap, name) {
+  var codes = keymap.getDomCodes();
+  assert.strictEqual(codes[0], null, name + ': unknown code');
+  var keyA = codes.indexOf('KeyA');
+  var escape = codes.indexOf('Escape');
+  var convert = function(values, from, to) {
+    return Array.from(keymap.convertKeycodes(new Uint32Array(values), from, to));
+  };
+  assert.deepStrictEqual(convert([keyA, escape, 0], 'code', 'usb'), [0x070004, 0x070029, 0]);
+  assert.deepStrictEqual(convert([keyA, escape, 0], 'code', 'evdev'), [30, 1, 0]);
+  assert.deepStrictEqual(convert([keyA, escape, 0], 'code', 'xkb'), [38, 9, 0]);
+  assert.deepStrictEqual(convert([0x070004, 0xdeadbeef], 'usb', 'code'), [keyA, 0]);
+
+  var indices = codes.map(function(_, i) { return i; });
+  var evdev = convert(indices, 'code', 'evdev');
+  var xkb = convert(indices, 'code', 'xkb');
+  ['usb', 'evdev', 'xkb'].forEach(function(kind) {
+    var keycodes = convert(indices, 'code', kind);
+    var back = convert(keycodes, kind, 'code');
+    indices.forEach(function(i) {
+      if (keycodes[i]) {
+        assert.strictEqual(back[i], i, name + ': ' + codes[i] + ' through ' + kind);
+      }
+    });
+  });
+  indices.forEach(function(i) {
+    assert.strictEqual(xkb[i], evdev[i] ? evdev[i] + 8 : 0, name + ': xkb keycode of ' + codes[i]);
+  });
+}
+
+// $XCOMPOSEFILE includes `included`, whose sequence for <dead_acute> <e> the
+// test changes to check that the cached table is rebuilt.
+function readIncludedComposeResult() {
+  var text = fs.readFileSync(path.join(path.dirname(process.env.XCOMPOSEFILE), 'included'), 'utf8');
+  return /"(.*)"/.exec(text)[1];
+}
+
+function checkCompose(keymap, name) {
+  keymap.setKeyMapCacheDirectory(path.dirname(process.env.XCOMPOSEFILE));
+  assert.strictEqual(keymap.getComposeResult(['Multi_key', 'a', 'e']), '\u00e6', name);
+  assert.strictEqual(keymap.getComposeResult(['dead_acute', 'e']), readIncludedComposeResult(), name);
+  assert.strictEqual(keymap.getComposeResult(['Multi_key', 'a']), null, name + ': incomplete sequence');
+  assert.strictEqual(keymap.getComposeResult(['Multi_key', 'e', 'a']), null, name + ': unknown sequence');
+  assert.deepStrictEqual(keymap.findComposeSequences('\u00e6').sort(), [['Multi_key', 'A', 'E'], ['Multi_key', 'a', 'e']], name);
+  assert.deepStrictEqual(keymap.findComposeSequences('\u00f8'), [], name);
+}
+
+var CODE_KEY = 0x80000000;
+var CTRL = 2;
+var SHIFT = 8;
+
+function getKeybindings(keymap) {
+  var codes = keymap.getDomCodes();
+  return new Uint32Array([
+    'z'.charCodeAt(0), CTRL, 0, 0,
+    CODE_KEY | codes.indexOf('KeyY'), CTRL, 0, 0,
+    '/'.charCodeAt(0), CTRL, 0, 0,
+    'k'.charCodeAt(0), CTRL, '7'.charCodeAt(0), CTRL | SHIFT,
+    0x20ac, CTRL, 0, 0
+  ]);
+}
+
+// On de_ch, z is on KeyY, / is Shift+7 and the euro sign is AltGr+E
+var RESOLVED_KEYBINDINGS = {
+  en: {
+    labels: ['Ctrl+Z', 'Ctrl+Y', 'Ctrl+/', 'Ctrl+K Ctrl+Shift+7', 'Ctrl+\u20ac'],
+    flags: [0, 0, 0, 0, 1],
+    conflicts: [-1, -1, -1, -1, -1]
+  },
+  de_ch: {
+    labels: ['Ctrl+Z', 'Ctrl+Z', 'Ctrl+Shift+7', 'Ctrl+K Ctrl+Shift+7', 'Ctrl+AltGr+E'],
+    flags: [0, 0, 0, 0, 0],
+    conflicts: [1, 0, -1, -1, -1]
+  }
+};
+
+function checkKeybindings(keymap, name) {
+  var codes = keymap.getDomCodes();
+  var bindings = getKeybindings(keymap);
+  keymap.setKeybindings(bindings);
+  var resolved = keymap.resolveKeybindings();
+  assert.deepStrictEqual(Array.from(resolved.indices), [0, 1, 2, 3, 4], name);
+  // A binding to a code is pressed on that code
+  assert.deepStrictEqual(Array.from(resolved.chords.subarray(4, 8)), [codes.indexOf('KeyY'), CTRL, 0, 0], name);
+  var expected = RESOLVED_KEYBINDINGS[name];
+  if (expected) {
+    assert.deepStrictEqual(resolved.labels, expected.labels, name);
+    assert.deepStrictEqual(Array.from(resolved.flags), expected.flags, name);
+    assert.deepStrictEqual(Array.from(resolved.conflicts), expected.conflicts, name);
+  }
+
+  // Only changes are reported, and new bindings are reported in full again
+  assert.strictEqual(keymap.resolveKeybindings().indices.length, 0, name + ': unchanged');
+  keymap.setKeybindings(bindings.subarray(0, 8));
+  assert.deepStrictEqual(Array.from(keymap.resolveKeybindings().indices), [0, 1], name + ': replaced');
+
+  // Each env has bindings of its own
+  var worker = new workerThreads.Worker(
+    'var keymap = require(' + JSON.stringify(require.resolve('../index')) + ');' +
+    'keymap.setKeybindings(new Uint32Array([97, 2, 0, 0]));' +
+    'require("worker_threads").parentPort.postMessage(keymap.resolveKeybindings().labels);',
+    { eval: true });
+  worker.on('message', function(labels) {
+    assert.deepStrictEqual(labels, ['Ctrl+A'], name + ': worker');
+    keymap.setKeybindings(bindings.subarray(0, 8));
+    assert.deepStrictEqual(Array.from(keymap.resolveKeybindings().indices), [0, 1], name + ': after worker');
+  });
+}
+
+var CHECKS = [checkSerialization, checkKeycodeConversion, checkCompose, checkKeybindings];
+
+if (process.env.NATIVE_KEYMAP_FIXTURE) {
+  // The fixture is read when the keyboard is first queried, so each one gets its own process
+  var keymap = require('../index');
+  var fixtureName = path.basename(process.env.NATIVE_KEYMAP_FIXTURE, '.txt');
+  CHECKS.forEach(function(check) {
+    check(keymap, fixtureName);
+  });
+
+  var codes = keymap.getDomCodes();
+  var indices = new Uint32Array(codes.length).map(function(_, i) { return i; });
+  var keycodes = {};
+  keymap.convertKeycodes(indices, 'code', 'xkb').forEach(function(keycode, i) {
+    if (codes[i]) {
+      keycodes[codes[i]] = keycode;
+    }
+  });
+  process.stdout.write(JSON.stringify({ keyMap: keymap.getKeyMap(), keycodes: keycodes }));
+  return;
+}
+
+function readFixture(file) {
+  var text = fs.readFileSync(file, 'utf8');
+  var start = text.indexOf('getKeyMap:');
+  assert.notStrictEqual(start, -1, file + ' has no keymap');
+  // The keymap was printed with util.inspect, so it is an object literal
+  return new Function('return (' + text.slice(start + 'getKeyMap:'.length) + ');')();
+}
+
+var composeDirectory = fs.mkdtempSync(path.join(os.tmpdir(), 'native-keymap-'));
+var composeFile = path.join(composeDirectory, 'Compose');
+fs.writeFileSync(composeFile, [
+  'include "' + path.join(composeDirectory, 'included') + '"',
+  '<Multi_key> <a> <e> : "\u00e6"',
+  '<Multi_key> <A> <E> : "\u00e6"',
+  ''
+].join('\n'));
+fs.writeFileSync(path.join(composeDirectory, 'included'), '<dead_acute> <e> : "\u00e9"\n');
+
+function runFixture(name) {
+  var file = path.join(__dirname, 'linux', name + '.txt');
+  var env = Object.assign({}, process.env, { NATIVE_KEYMAP_FIXTURE: file, XCOMPOSEFILE: composeFile });
+  var result = childProcess.spawnSync(process.execPath, [__filename], { env: env, encoding: 'utf8' });
+  assert.strictEqual(result.status, 0, name + ': ' + result.stderr);
+  return result;
+}
+
+FIXTURES.forEach(function(name) {
+  var result = runFixture(name);
+
+  var expected = readFixture(path.join(__dirname, 'linux', name + '.txt'));
+  var output = JSON.parse(result.stdout);
+  var actual = output.keyMap;
+  // X cannot send keycodes above 255, for which the recording Xlib looked up
+  // the keycode of the low byte and the fixture backend looks up nothing
+  var isSendable = function(code) {
+    return output.keycodes[code] <= 255;
+  };
+  Object.keys(expected).filter(isSendable).forEach(function(code) {
+    assert.deepStrictEqual(actual[code], expected[code], name + ': ' + code);
+  });
+  // Codes added since the fixture was recorded are not on the keyboard
+  Object.keys(actual).filter(isSendable).forEach(function(code) {
+    if (!(code in expected)) {
+      Object.keys(actual[code]).forEach(function(level) {
+        assert.strictEqual(actual[code][level], '', name + ': ' + code + '.' + level);
+      });
+    }
+  });
+  console.log(name + ': ok');
+});
+
+// The first fixture compiled the Compose table, the others loaded it from the
+// cache, which has to be rebuilt once an included file changes
+assert.strictEqual(fs.readdirSync(composeDirectory).filter(function(file) { return /^compose-.*\.bin$/.test(file); }).length, 1);
+fs.writeFileSync(path.join(composeDirectory, 'included'), '<dead_acute> <e> : "\u00e9\u00e9"\n');
+runFixture(FIXTURES[0]);
+console.log('compose cache: ok');
+
+fs.readdirSync(composeDirectory).forEach(function(file) {
+  fs.unlinkSync(path.join(composeDirectory, file));
+});
+fs.rmdirSync(composeDirectory);